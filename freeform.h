@@ -102,7 +102,8 @@ typedef ff_GeneralHandle ff_ParamHandle;
  * @brief Parameter definition
  */
 typedef struct ff_ParameterDef {
-    ff_float v; /**< Parameter value */
+    ff_float v;     /**< Parameter value */
+    ff_float scale; /**< Characteristic magnitude for equilibration, e.g. 1e-6 for micrometres (0 = unscaled, or automatic under FF_EQUIL_RUIZ) */
 } ff_ParameterDef;
 
 /**
@@ -276,10 +277,14 @@ typedef struct ff_Constraint {
     ff_ConstraintDef def; /**< Constraint definition */
 
     struct {
-        ff_float    err;      /**< Current constraint error */
-        ff_Expr**   dervs;    /**< Symbolic derivatives */
-        ff_float*   dervs_y;  /**< Evaluated derivative values */
-    } JMR; /**< Jacobian matrix row data */
+        ff_float    err;       /**< Current constraint error */
+        ff_Expr**   dervs;     /**< Symbolic derivatives (one per referenced parameter) */
+        ff_float*   dervs_y;   /**< Evaluated derivative values */
+        uint16_t*   dervs_col; /**< Jacobian column of each derivative */
+        ff_ParamHandle* dervs_param; /**< Parameter each derivative is taken by */
+        const ff_Expr*  dervs_of;    /**< Equation the derivatives were taken of */
+        uint16_t    dervs_cnt; /**< Number of nonzero entries in this row */
+    } JMR; /**< Jacobian matrix row data (sparse) */
 } ff_Constraint;
 
 /** @} */
@@ -302,6 +307,281 @@ typedef struct Jacobian_Matrix_Row {
 
 
 
+/** @defgroup Solver Solver Configuration
+ *  @brief Options controlling how the Newton step is computed
+ *  @{
+ */
+
+/**
+ * @brief Linear solver used for each Newton step
+ */
+enum ff_LinearMethod {
+    FF_LINEAR_AUTO,   /**< Sparse LU for square systems, else dense, banded or LSQR by size and fill (see ff_SolveStats) */
+    FF_LINEAR_DENSE,  /**< Dense normal matrix with blocked Cholesky */
+    FF_LINEAR_LSQR,   /**< Matrix-free LSQR, needs only J*v and J^T*v products */
+    FF_LINEAR_LU,     /**< Sparse LU of J itself; square, structurally nonsingular systems only */
+    FF_LINEAR_SMALL,  /**< Fixed-size unrolled dense kernels; systems of up to FF_SMALL_MAX unknowns, larger ones fall back as noted in ff_SolveStats::reason */
+    FF_LINEAR_BANDED, /**< Banded Cholesky of the normal matrix, O(n*b^2) for half-bandwidth b */
+    FF_LINEAR_CUSTOM  /**< User backend in ff_SolverConfig::backend */
+};
+
+/**
+ * @brief Space in which the dense normal equations are formed
+ */
+enum ff_NormalForm {
+    FF_NORMAL_AUTO, /**< J^T*J when rows > cols and J has full structural column rank, else J*J^T */
+    FF_NORMAL_JJT,  /**< rows x rows, minimum-norm step (under-constrained systems) */
+    FF_NORMAL_JTJ   /**< cols x cols, least-squares step (over-constrained/redundant systems) */
+};
+
+/**
+ * @brief Preconditioner for iterative linear solvers
+ */
+enum ff_Preconditioner {
+    FF_PRECOND_NONE,  /**< No preconditioning */
+    FF_PRECOND_JACOBI /**< Column scaling by inverse Jacobian column norms; not applied when J has more columns than rows, where it would change the minimum-norm step */
+};
+
+/**
+ * @brief How the Jacobian is refreshed between Newton iterations
+ */
+enum ff_JacobianUpdate {
+    FF_JACOBIAN_EXACT,  /**< Evaluate and factor J every iteration (full Newton) */
+    FF_JACOBIAN_CHORD,  /**< Keep the last factorization until progress stalls (chord method) */
+    FF_JACOBIAN_BROYDEN /**< As CHORD, plus rank-one Broyden corrections to the reused inverse */
+};
+
+/**
+ * @brief Precision of the dense normal-matrix factorization
+ */
+enum ff_FactorPrecision {
+    FF_PRECISION_DOUBLE, /**< Factor in ff_float */
+    FF_PRECISION_MIXED   /**< Factor in float, refine the step against the ff_float normal matrix */
+};
+
+/**
+ * @brief Scaling of the Newton system
+ */
+enum ff_Equilibration {
+    FF_EQUIL_NONE, /**< Solve with J as evaluated */
+    FF_EQUIL_ROWS, /**< Rows scaled to unit max-norm, columns only by ff_ParameterDef::scale; keeps the minimum-norm step */
+    FF_EQUIL_RUIZ  /**< Rows and columns scaled to unit max-norm (Ruiz), honouring ff_ParameterDef::scale; for well- and over-constrained sketches */
+};
+
+/**
+ * @brief Read-only, row-compressed view of the Jacobian handed to linear-solver backends
+ *
+ * The nonzeros of row r are col[row_ptr[r]] .. col[row_ptr[r + 1] - 1], sorted
+ * by column, with their values in val. The pattern only changes between
+ * analyze calls; val is current whenever factor is called.
+ */
+typedef struct ff_JacobianView {
+    uint16_t        rows;        /**< Constraint count */
+    uint16_t        cols;        /**< Parameter count */
+    uint32_t        nnz;         /**< Stored entries */
+    const uint32_t* row_ptr;     /**< Row pointers (rows + 1) */
+    const uint16_t* col;         /**< Column indices */
+    const ff_float* val;         /**< Values */
+    uint16_t        struct_rank; /**< Structural rank (maximum row/column matching) */
+} ff_JacobianView;
+
+/**
+ * @brief Linear-solver backend
+ *
+ * Computes Newton steps dx from J*dx = b: the exact solution for square,
+ * nonsingular J, otherwise the least-squares or minimum-norm step (iterative
+ * backends may stop once the residual is within `tol` of ||b||).
+ *
+ * analyze runs once per Jacobian pattern and may be NULL; returning false makes
+ * the solver use a built-in backend for that pattern. factor runs whenever J is
+ * re-evaluated and reports the numerical rank it found; returning false makes
+ * that iteration take a built-in least-squares step. solve may run several
+ * times per factorization (Jacobian reuse) and must leave b untouched.
+ */
+typedef struct ff_LinearBackend {
+    const char* name; /**< Name shown in solver traces */
+    void*       user; /**< Passed back to every callback */
+    bool (*analyze)(void* user, const ff_JacobianView* J);
+    bool (*factor)(void* user, const ff_JacobianView* J, uint16_t* rank);
+    void (*solve)(void* user, const ff_JacobianView* J, const ff_float* b, ff_float tol, ff_float* dx);
+} ff_LinearBackend;
+
+/**
+ * @brief Solver configuration
+ *
+ * Stored in ff_Sketch::config and read by ffSketch_Solve.
+ */
+typedef struct ff_SolverConfig {
+    enum ff_LinearMethod   linear;           /**< Linear solver for the Newton step */
+    enum ff_NormalForm     normal_form;      /**< Normal-equation space for dense solves */
+    enum ff_Preconditioner precond;          /**< Preconditioner for LSQR */
+    uint32_t               dense_max_rows;   /**< Largest normal matrix FF_LINEAR_AUTO builds densely */
+    uint32_t               krylov_max_iters; /**< LSQR iteration cap per step (0 = rows + cols) */
+    ff_float               forcing_max;      /**< Upper bound of the inexact-Newton forcing term */
+    enum ff_JacobianUpdate jacobian_update;  /**< Jacobian refresh policy */
+    uint32_t               jacobian_max_reuse; /**< Iterations a stale Jacobian may be reused before a refresh */
+    ff_float               jacobian_stall;   /**< Refresh once ||F|| shrinks by less than this factor per iteration */
+    enum ff_FactorPrecision precision;       /**< Dense factorization precision */
+    uint32_t               refine_max_iters; /**< Iterative-refinement sweeps before falling back to double */
+    ff_float               refine_tol;       /**< Refinement stops once ||correction|| <= refine_tol * ||step|| */
+    const ff_LinearBackend* backend;         /**< Backend for FF_LINEAR_CUSTOM (must outlive the solves) */
+    bool                   reorder;          /**< Order parameters and constraints by reverse Cuthill-McKee at relink */
+    enum ff_Equilibration  equilibrate;      /**< Scaling of J before each factorization */
+    bool                   detect_dependent; /**< Find dependent constraints on the first iteration and leave them out of the Newton steps */
+    uint32_t               stall_window;     /**< Abort after this many consecutive stalled iterations, or this many without a new best ||F|| (0 = never) */
+    ff_float               stall_ratio;      /**< An iteration is stalled if ||F|| changes by less than this factor either way; a new best must beat the old by it */
+    bool                   decompose;        /**< Split the sketch into independent parts at relink and solve each on its own */
+    bool                   triangular;       /**< With decompose, also split each part into blocks solved one after another */
+    bool                   closed_form;      /**< Solve 1x1 and 2x2 systems of degree <= 2 directly instead of iterating */
+    uint16_t               threads;          /**< Workers solving independent components concurrently (1 = on the calling thread) */
+} ff_SolverConfig;
+
+/**
+ * @brief Convergence behaviour over the last iterations of a solve
+ *
+ * Judged from the contraction ratio q = ||F_k|| / ||F_k-1|| and its
+ * predecessor: Newton's quadratic convergence roughly squares q every step,
+ * linear convergence (chord steps, inexact solves) keeps it about constant.
+ */
+enum ff_ConvergenceRate {
+    FF_RATE_NONE,      /**< Too few iterations to judge */
+    FF_RATE_QUADRATIC, /**< q shrinking about quadratically */
+    FF_RATE_LINEAR,    /**< q steady below stall_ratio */
+    FF_RATE_STALLED,   /**< q between stall_ratio and 1 / stall_ratio */
+    FF_RATE_DIVERGING  /**< q above 1 / stall_ratio */
+};
+
+/** @brief How the last solve ended */
+enum ff_SolveResult {
+    FF_SOLVE_CONVERGED,   /**< Every constraint within tolerance */
+    FF_SOLVE_MAX_STEPS,   /**< max_steps ran out while still making progress */
+    FF_SOLVE_STALLED,     /**< Aborted: ||F|| flat or no new best for stall_window iterations, or steps below rounding */
+    FF_SOLVE_DIVERGED,    /**< Aborted: no new best ||F|| for stall_window iterations and well above it, or not finite */
+    FF_SOLVE_CONFLICTING, /**< Independent constraints converged, some dependent ones conflict with them */
+    FF_SOLVE_PAUSED,      /**< The time budget of ffSketch_SolveTimed ran out; calling it again continues */
+    FF_SOLVE_CANCELLED    /**< ffSolveJob_Cancel stopped a background solve; parameters are as before it */
+};
+
+/**
+ * @brief What the last relink measured and what the last solve did
+ *
+ * The Jacobian measurements are taken at relink; FF_LINEAR_AUTO compares the
+ * cost estimates (rough flop counts per Newton step) to choose between the
+ * dense, banded and LSQR backends.
+ */
+typedef struct ff_SolveStats {
+    uint16_t             rows;        /**< Constraints */
+    uint16_t             cols;        /**< Parameters */
+    uint32_t             nnz;         /**< Jacobian nonzeros */
+    ff_float             density;     /**< nnz / (rows * cols) */
+    uint16_t             normal_dim;  /**< Dimension of the normal matrix the dense backend would build */
+    ff_float             normal_fill; /**< Envelope of that matrix's lower triangle / n(n+1)/2 */
+    uint16_t             normal_band; /**< Half-bandwidth of that matrix under the relink ordering */
+    bool                 pattern_reused; /**< The last relink found the pattern unchanged and kept its symbolic analysis */
+    uint32_t             differentiated; /**< Derivatives the last relink had to take; the others were kept from before */
+    ff_float             dense_cost;  /**< Estimated dense backend cost */
+    ff_float             band_cost;   /**< Estimated banded backend cost */
+    ff_float             lsqr_cost;   /**< Estimated LSQR backend cost */
+    enum ff_LinearMethod method;      /**< Linear method the last solve started with (the fallback's if config.linear could not handle the system) */
+    const char*          reason;      /**< Why that method was chosen */
+    const char*          backend;     /**< Backend that computed the last step */
+    uint32_t             iterations;  /**< Newton iterations of the last solve */
+    uint16_t             redundant;   /**< Dependent constraints the last solve satisfied anyway */
+    uint16_t             conflicting; /**< Dependent constraints the last solve left unsatisfied */
+    enum ff_SolveResult  result;      /**< How the last solve ended */
+    enum ff_ConvergenceRate rate;     /**< Convergence rate over its last iterations */
+    ff_float             residual;    /**< ||F|| of the Newton rows at its last iteration */
+    ff_float             step_norm;   /**< ||dx|| of its last step */
+    uint16_t             components;  /**< Independent components the last relink found (see ffSketch_ComponentCount) */
+    uint16_t             blocks;      /**< Systems solved in sequence for them (config.triangular) */
+    uint16_t             closed_form; /**< Of those, how many the last solve took in closed form (config.closed_form) */
+} ff_SolveStats;
+
+/**
+ * @brief Kinds of dependent constraints
+ *
+ * A constraint is dependent when its Jacobian row is a combination of the rows
+ * of other constraints at the start of a solve. Whether it agrees with them is
+ * only known once they are satisfied.
+ */
+enum ff_Dependency {
+    FF_DEPENDENT_REDUNDANT,  /**< Satisfied once the others are (e.g. a duplicate) */
+    FF_DEPENDENT_CONFLICTING /**< Cannot be satisfied together with the others */
+};
+
+/**
+ * @brief Compressed sparse column matrix
+ */
+typedef struct ff_CscMatrix {
+    uint16_t  n_rows; /**< Row count */
+    uint16_t  n_cols; /**< Column count */
+    uint32_t  nnz;    /**< Stored entries */
+    uint32_t  cap;    /**< Allocated entries */
+    uint32_t* p;      /**< Column pointers (n_cols + 1) */
+    uint16_t* i;      /**< Row indices */
+    ff_float* x;      /**< Values */
+} ff_CscMatrix;
+
+/** @brief Largest system (normal-matrix dimension) handled by FF_LINEAR_SMALL */
+#define FF_SMALL_MAX 16
+
+/**
+ * @brief Fixed-size factorization of a small system, stored inline (no heap)
+ */
+typedef struct ff_SmallFactor {
+    ff_float a[FF_SMALL_MAX * FF_SMALL_MAX]; /**< Factors, column-major n x n */
+    uint8_t  piv[FF_SMALL_MAX];              /**< LU row interchanges / Cholesky skipped pivots */
+    uint8_t  n;                              /**< Dimension */
+    uint8_t  kind;                           /**< What a holds: LU of J, Cholesky of J^T*J or of J*J^T */
+} ff_SmallFactor;
+
+/**
+ * @brief Banded Cholesky factorization of a normal matrix
+ */
+typedef struct ff_BandFactor {
+    ff_float* a;        /**< Lower band, column-major: (i, j) at a[(i - j) + j * (band + 1)] */
+    uint8_t*  skip;     /**< Dependent (skipped) pivots */
+    size_t    cap;      /**< Entries allocated in a */
+    uint16_t  skip_cap; /**< Entries allocated in skip */
+    uint16_t  n;        /**< Dimension of the current factor */
+    uint16_t  band;     /**< Half-bandwidth of the current factor */
+    uint16_t  band_jtj; /**< Half-bandwidth of J^T*J, measured at relink */
+    uint16_t  band_jjt; /**< Half-bandwidth of J*J^T, measured at relink */
+} ff_BandFactor;
+
+/**
+ * @brief Sparse LU factorization P*J = L*U with threshold partial pivoting
+ */
+typedef struct ff_SparseLU {
+    ff_CscMatrix L;    /**< Unit lower factor, diagonal stored first in each column */
+    ff_CscMatrix U;    /**< Upper factor, diagonal stored last in each column */
+    uint16_t*    pinv; /**< Row -> pivot position */
+    ff_float*    x;    /**< Dense work vector */
+    int32_t*     iw;   /**< Integer work (DFS stack and reach set) */
+    uint32_t*    mark; /**< DFS visit stamps */
+    uint32_t     stamp;
+    bool         symbolic; /**< Pivot order and L/U patterns are valid for numeric refactorization */
+} ff_SparseLU;
+
+/**
+ * @brief Structure-only analysis of the Jacobian, kept across relinks while its pattern is unchanged
+ *
+ * Besides the band order held here, the structural matching, the CSC pattern
+ * of J, the sparse LU (pivot order and fill) and a custom backend's analysis
+ * share this lifetime.
+ */
+typedef struct ff_Symbolic {
+    uint64_t  hash;      /**< FNV-1a hash of the slot-order pattern and config.reorder (0 = nothing cached) */
+    uint16_t  rows;      /**< Constraint count */
+    uint16_t  cols;      /**< Parameter count */
+    uint32_t* rowptr;    /**< The slot-order pattern itself (rows + 1), to confirm a hash match */
+    uint16_t* col;       /**< Its column indices */
+    uint16_t* col_new;   /**< Band order: new index of each slot-order column (NULL without reorder) */
+    uint16_t* row_order; /**< Band order: slot-order row placed at each position */
+} ff_Symbolic;
+
+/** @} */
+
 /** @defgroup Sketch Sketch
  *  @brief Main container for a parametric sketch system
  *  @{
@@ -311,6 +591,9 @@ FF_DECLARE_GENTABLE(ff_param,      ff_Parameter);
 FF_DECLARE_GENTABLE(ff_entity,     ff_Entity);
 FF_DECLARE_GENTABLE(ff_constraint, ff_Constraint);
 
+/** @brief Background solve started by ffSketch_SolveAsync (opaque) */
+typedef struct ff_SolveJob ff_SolveJob;
+
 /**
  * @brief Parametric sketch container
  *
@@ -324,12 +607,94 @@ typedef struct ff_Sketch {
 
     bool link_outdated; /**< Whether entity-parameter links need updating */
 
-    ff_float* normal_mtr;    /**< Normal matrix for solving */
+    ff_SolverConfig config; /**< Solver options */
+    ff_SolveStats   stats;  /**< Measurements and choices of the last relink/solve */
+
+    ff_float* normal_mtr;    /**< Normal matrix / Cholesky factor (allocated on first dense solve) */
+    float*    normal_f;      /**< Single-precision Cholesky factor plus one float vector (mixed precision) */
+    bool      normal_single; /**< normal_f holds the current factor and normal_mtr is still unfactored */
+    ff_float  normal_tiny;   /**< Pivot threshold of the current dense factorization */
+    uint8_t*  normal_skip;   /**< Dependent (skipped) pivots of the last dense factorization */
+    uint16_t  normal_dim;    /**< Dimension normal_mtr is allocated for */
+    ff_float* dense_jac;     /**< Contiguous dense Jacobian for the SYRK normal-matrix build */
+    size_t    dense_jac_cap; /**< Entries allocated in dense_jac */
     ff_float* itrm_sol;      /**< Intermediate solution vector */
     ff_float* cached_params; /**< Cached parameter values */
+    ff_float* scratch;       /**< Solver scratch: Krylov vectors, dense row, step, residuals */
+    ff_float* scale;         /**< Equilibration: row factors R | column factors C | work (cols) */
+    ff_float* broyden;       /**< Broyden correction pairs (y: rows, u: cols) for the reused inverse */
+    size_t    broyden_cap;   /**< Entries allocated in broyden */
+    uint16_t* param_cols;    /**< Parameter slot index -> Jacobian column */
+    uint16_t  struct_rank;   /**< Structural rank of the Jacobian (maximum row/column matching) */
+    uint16_t* match_row;     /**< Jacobian column -> matched row (FF_INVALID_INDEX if unmatched) */
+    ff_ConstraintHandle* dependent; /**< Dependent constraints of the last solve: redundant ones, then conflicting ones */
+    uint16_t* dependent_perm; /**< Packed row -> row before the dependent ones were moved to the end (during a solve) */
+
+    ff_CscMatrix jac_csc;    /**< Column-compressed copy of J for direct factorization */
+    uint32_t*    jac_map;    /**< Row-major nonzero -> position in jac_csc */
+    uint32_t*    jac_rowptr; /**< Row pointers of the packed Jacobian rows */
+    uint16_t*    jac_col;    /**< Column indices of all rows (JMR.dervs_col points in here) */
+    ff_float*    jac_val;    /**< Values of all rows (JMR.dervs_y points in here) */
+    uint32_t     jac_nnz;    /**< Jacobian nonzeros */
+    const ff_LinearBackend* analyzed; /**< Custom backend that has analyzed the current pattern */
+    ff_SparseLU  lu;         /**< Sparse LU factors of J */
+    ff_SmallFactor small;    /**< Factors of the fixed-size kernels */
+    ff_BandFactor  band;     /**< Banded normal-matrix factor */
+    ff_Symbolic    sym;      /**< Cached symbolic analysis of the Jacobian pattern */
+
+    struct {
+        enum ff_NormalForm form;    /**< Normal-equation space of the dense backend */
+        bool               mixed;   /**< Dense backend may still factor in single precision */
+        ff_float           epsilon; /**< Pivot threshold */
+        uint16_t           rows;    /**< Jacobian rows covered by the current factorization */
+        bool               factored;/**< A factorization of the last solve is still valid */
+        bool               current; /**< It is of J at the parameters' current values (else refreshed on first reuse) */
+        ff_LinearBackend   backend; /**< Backend that holds that factorization */
+    } solve_state; /**< Per-solve state of the built-in backends */
+    struct {
+        uint16_t kept;        /**< Rows left in once the dependent ones were set aside */
+        bool     refresh;     /**< J is due for a refresh */
+        bool     stale;       /**< The last step came from a reused J */
+        uint32_t reused;      /**< Steps taken on the current factorization */
+        uint32_t n_broyden;   /**< Broyden updates on top of it */
+        ff_float eta;         /**< Forcing term */
+        ff_float fnorm_prev;  /**< ||F|| one iteration back */
+        ff_float fnorm_prev2; /**< ||F|| two iterations back */
+        ff_float fnorm_best;  /**< Best ||F|| so far */
+        uint32_t flat;        /**< Iterations ||F|| stayed flat */
+        uint32_t since_best;  /**< Iterations since ||F|| last improved on its best */
+        uint32_t tiny_steps;  /**< Steps in a row below rounding level */
+    } paused; /**< Where a paused (timed) solve of this system left its iteration */
 
     ff_Constraint**  tmp_contraints;
     ff_Parameter**   tmp_params;
+    uint16_t*        cons_slot;  /**< Row -> constraint slot */
+    uint16_t*        param_slot; /**< Column -> parameter slot */
+
+    struct ff_Sketch*       parts;      /**< Blocks in solve order, each solved as a sketch of its own (NULL when solved whole) */
+    uint16_t                part_count; /**< Number of parts */
+    uint16_t                comp_count; /**< Number of components */
+    uint16_t*               comp_ptr;   /**< Component k owns parts comp_ptr[k]..comp_ptr[k+1]-1 */
+    ff_SolveStats*          comp_stats; /**< Combined stats of each component's parts */
+    bool*                   comp_dirty; /**< Components an edit touched since the last relink; only these are relinked */
+    bool                    link_triangular; /**< config.triangular the parts were built with */
+    uint16_t*               cons_part;  /**< Constraint slot -> component (FF_INVALID_INDEX if dead) */
+    uint16_t*               param_part; /**< Parameter slot -> component (FF_INVALID_INDEX if dead or in no constraint) */
+    const struct ff_Sketch* owner;      /**< Sketch this one is a part of; it shares the owner's tables */
+    bool                    dof_outdated; /**< Whether the structural analysis below predates an edit */
+    uint8_t*                dof_cons;   /**< Constraint slot -> side of the structural analysis (over-determined, square, under-determined) */
+    uint8_t*                dof_param;  /**< Parameter slot -> side of the structural analysis, or unmatched */
+    uint16_t                dof_total;  /**< Unmatched parameters of the structural analysis */
+    uint16_t*               dof;        /**< Unmatched parameters of each component (NULL until asked for after a relink) */
+    uint16_t                dof_comps;  /**< Components counted in dof */
+    struct ff_Sketch*       active;     /**< Part being worked on; built-in backends handed the owner act on it */
+    ff_ConstraintHandle*    drag;       /**< Constraints holding the dragged parameters at their targets (NULL when no drag is on) */
+    ff_Expr**               drag_to;    /**< Target constant of each of them */
+    uint16_t                drag_count; /**< Number of dragged parameters */
+    uint16_t*               resume_block; /**< Per component: first block a paused solve has yet to finish (NULL when none is paused) */
+    uint32_t*               resume_steps; /**< Per component: iterations that block has taken so far */
+    ff_float*               resume_carry; /**< How far the paused solve has moved each parameter slot */
+    ff_SolveJob*            job;        /**< Background solve the link is lent to (NULL if none) */
 
 } ff_Sketch;
 
@@ -372,10 +737,271 @@ FF_API void ffSketch_Free(ff_Sketch* skt);
  * @param skt Sketch to solve
  * @param tolerance Convergence tolerance
  * @param max_steps Maximum solver iterations
- * @return true if converged, false otherwise
+ * @return true if converged, false otherwise (skt->stats.result says why)
  */
 FF_API bool ffSketch_Solve(ff_Sketch* skt, double tolerance, uint32_t max_steps);
 
+/**
+ * @brief Solve for at most a given wall-clock time, resuming where the last call stopped
+ *
+ * Stops between Newton iterations once budget_us has passed, with
+ * skt->stats.result FF_SOLVE_PAUSED and the parameters at the last iterate.
+ * The next call continues the paused solve: blocks and components that have
+ * finished are not looked at again, the others go on from their iterate with
+ * their factorization, Jacobian reuse and stall monitoring as they were, and
+ * max_steps counts the iterations of all calls. Every call takes at least one
+ * iteration. An edit, or ffSketch_Solve, discards the paused solve; so
+ * should the caller after moving parameters itself, by calling ffSketch_Solve.
+ * @param skt Sketch to solve
+ * @param tolerance Convergence tolerance
+ * @param max_steps Maximum solver iterations of each system, over all calls
+ * @param budget_us Time this call may take, in microseconds
+ * @return true if converged; false if paused (skt->stats.result) or failed
+ */
+FF_API bool ffSketch_SolveTimed(ff_Sketch* skt, double tolerance, uint32_t max_steps, uint32_t budget_us);
+
+/**
+ * @brief Start solving the sketch on a background thread
+ *
+ * The solver works on its own copy of the parameter and constraint tables,
+ * so the sketch's parameters, entities and constraints stay readable while
+ * it runs and keep their values until the job is finished. The results are
+ * then copied in all at once, on the calling thread, by ffSolveJob_Done or
+ * ffSolveJob_Wait. Until then the sketch cannot be edited or solved: edits
+ * fail, and ffSketch_Solve returns false. Values written into the sketch
+ * meanwhile are overwritten. Relinking, if needed, happens before this
+ * returns. Without threads (FF_NO_THREADS), the solve runs before this
+ * returns.
+ * @param skt Sketch to solve
+ * @param tolerance Convergence tolerance
+ * @param max_steps Maximum solver iterations
+ * @return Job to poll, wait on or cancel, exactly once to finish it; NULL if the sketch already has one
+ */
+FF_API ff_SolveJob* ffSketch_SolveAsync(ff_Sketch* skt, double tolerance, uint32_t max_steps);
+
+/**
+ * @brief Poll a background solve, and finish it if it is done
+ *
+ * Once the solve is done, copies its results into the sketch (parameters,
+ * constraint errors, stats) and frees the job.
+ * @param job Job from ffSketch_SolveAsync
+ * @return False while it is still running; true once finished (job is then invalid, see skt->stats.result)
+ */
+FF_API bool ffSolveJob_Done(ff_SolveJob* job);
+
+/**
+ * @brief Wait for a background solve and finish it
+ *
+ * As ffSolveJob_Done, blocking until the solve is done; frees the job.
+ * @param job Job from ffSketch_SolveAsync
+ * @return true if converged (as ffSketch_Solve)
+ */
+FF_API bool ffSolveJob_Wait(ff_SolveJob* job);
+
+/**
+ * @brief Cancel a background solve
+ *
+ * Stops it after its current iteration and frees the job. The parameters
+ * keep the values they had when it started; skt->stats.result is
+ * FF_SOLVE_CANCELLED.
+ * @param job Job from ffSketch_SolveAsync
+ */
+FF_API void ffSolveJob_Cancel(ff_SolveJob* job);
+
+/**
+ * @brief Get a built-in linear-solver backend bound to a sketch
+ *
+ * Lets a custom backend delegate to (or time) a built-in one. The result is
+ * only usable from inside callbacks of an ffSketch_Solve on the same sketch.
+ * @param skt Sketch the backend works on
+ * @param method FF_LINEAR_DENSE, FF_LINEAR_LSQR, FF_LINEAR_LU, FF_LINEAR_SMALL or FF_LINEAR_BANDED (anything else gives the dense backend)
+ * @return Backend whose user pointer is skt
+ */
+FF_API ff_LinearBackend ffSketch_BuiltinBackend(ff_Sketch* skt, enum ff_LinearMethod method);
+
+/**
+ * @brief Get the dependent constraints found by the last solve
+ *
+ * Requires config.detect_dependent. Dependent constraints are left out of the
+ * Newton steps; afterwards each is redundant or conflicting, depending on
+ * whether the solution satisfies it.
+ * @param skt Solved sketch
+ * @param kind Which dependent constraints to list
+ * @param out Receives up to cap handles (may be NULL if cap is 0)
+ * @param cap Capacity of out
+ * @return Number of such constraints (also in skt->stats)
+ */
+FF_API uint16_t ffSketch_DependentConstraints(const ff_Sketch* skt, enum ff_Dependency kind, ff_ConstraintHandle* out, uint16_t cap);
+
+/**
+ * @brief Get the first-order sensitivity of the solution to constraint targets
+ *
+ * A driving dimension enters as the target t of its constraint, eq(x) = t
+ * instead of 0. dx/dt comes from the Jacobian factorization of the last
+ * ffSketch_Solve, one extra solve per driver. J is re-evaluated at the
+ * solution and refactored on the first call after the solve (and after
+ * ffSketch_Predict), so the derivatives are those at the solution.
+ * Fails if the sketch changed since, or the solve never factored J.
+ * @param skt Solved sketch
+ * @param drivers Driving constraints
+ * @param n_drivers Number of drivers
+ * @param params Parameters to report
+ * @param n_params Number of parameters
+ * @param dxdp Receives dx/dt, dxdp[d * n_params + k] for driver d and parameter k
+ * @return False if there is no factorization to reuse, or some driver or parameter
+ *         had no sensitivity (stale handle, dependent constraint); those entries are 0
+ */
+FF_API bool ffSketch_Sensitivity(ff_Sketch* skt, const ff_ConstraintHandle* drivers, uint16_t n_drivers,
+                                 const ff_ParamHandle* params, uint16_t n_params, ff_float* dxdp);
+
+/**
+ * @brief Move the parameters by the first-order prediction for shifted targets
+ *
+ * Warm start for the solve after a change of driving dimensions: x += dx/dt * delta,
+ * for all drivers at once and with a single solve against the last factorization
+ * (see ffSketch_Sensitivity). Shift the constraint equations by the same deltas,
+ * then call ffSketch_Solve.
+ * @param skt Solved sketch
+ * @param drivers Driving constraints
+ * @param deltas Change of each driver's target
+ * @param n Number of drivers
+ * @return False (parameters untouched) if there is no factorization to reuse or a driver is invalid or dependent
+ */
+FF_API bool ffSketch_Predict(ff_Sketch* skt, const ff_ConstraintHandle* drivers, const ff_float* deltas, uint16_t n);
+
+/**
+ * @brief Start dragging parameters
+ *
+ * Each parameter is held at a target, its current value to begin with, by a
+ * constraint of its own until ffSketch_EndDrag; ffSketch_Drag moves the
+ * targets. The first frame relinks the sketch for these constraints, the
+ * ones after it keep the link.
+ * @param skt Sketch
+ * @param params Parameters to drag, e.g. the x and y of a point
+ * @param n Number of parameters
+ * @return False (nothing started) if a drag is already on or a handle is stale
+ */
+FF_API bool ffSketch_BeginDrag(ff_Sketch* skt, const ff_ParamHandle* params, uint16_t n);
+
+/**
+ * @brief Move the dragged parameters and solve, one frame of a drag
+ *
+ * The parameters start from the first-order prediction for the new targets,
+ * taken from the factorization of the previous frame (see ffSketch_Predict),
+ * which usually leaves one Newton step to take. Steps are minimum-norm for
+ * under-constrained sketches, so parameters that are not dragged move as
+ * little as the constraints allow. A target the other constraints rule out
+ * gives the least-squares compromise, or FF_SOLVE_CONFLICTING with
+ * config.detect_dependent.
+ * @param skt Sketch with a drag on
+ * @param targets New value of each dragged parameter, in ffSketch_BeginDrag order
+ * @param tolerance Convergence tolerance
+ * @param max_steps Maximum solver iterations
+ * @return As ffSketch_Solve; false without solving if no drag is on
+ */
+FF_API bool ffSketch_Drag(ff_Sketch* skt, const ff_float* targets, double tolerance, uint32_t max_steps);
+
+/**
+ * @brief End a drag
+ *
+ * Drops the constraints holding the dragged parameters; every parameter keeps
+ * the value of the last frame. Does nothing while a background solve runs.
+ * @param skt Sketch
+ */
+FF_API void ffSketch_EndDrag(ff_Sketch* skt);
+
+/**
+ * @brief Get the number of independent components of the sketch
+ *
+ * Constraints that share no parameter, directly or through other constraints,
+ * belong to different components. With config.decompose each component is
+ * solved as a system of its own, with its own backend and convergence status;
+ * otherwise the sketch counts as one component. Relinks the sketch if needed.
+ * @param skt Sketch
+ * @return Component count (0 for a sketch without constraints)
+ */
+FF_API uint16_t ffSketch_ComponentCount(ff_Sketch* skt);
+
+/**
+ * @brief Get what the last relink and solve did for one component
+ *
+ * The sketch's own stats combine all components: sums of sizes, the slowest
+ * component's iterations, the first failing component's result.
+ * @param skt Sketch
+ * @param component Index below ffSketch_ComponentCount
+ * @return Stats of the component (the sketch's stats if it is solved whole), or NULL for a bad index
+ */
+FF_API const ff_SolveStats* ffSketch_ComponentStats(const ff_Sketch* skt, uint16_t component);
+
+/**
+ * @brief Get the component a constraint belongs to
+ *
+ * Relinks the sketch if needed.
+ * @param skt Sketch
+ * @param h Constraint handle
+ * @return Component index, or FF_INVALID_INDEX for a stale handle
+ */
+FF_API uint16_t ffSketch_ConstraintComponent(ff_Sketch* skt, ff_ConstraintHandle h);
+
+/**
+ * @brief Get the component a parameter belongs to
+ *
+ * Relinks the sketch if needed.
+ * @param skt Sketch
+ * @param h Parameter handle
+ * @return Component index, or FF_INVALID_INDEX for a stale handle or a parameter no constraint uses
+ */
+FF_API uint16_t ffSketch_ParameterComponent(ff_Sketch* skt, ff_ParamHandle h);
+
+/**
+ * @brief Get the structural degrees of freedom left in the sketch or one component
+ *
+ * Counts from the constraint/parameter graph alone, with a maximum matching
+ * of constraints to the parameters they use: parameters minus the matched
+ * ones. No derivatives or values are involved, so it is cheap enough to run
+ * after every edit, but a constraint that is only numerically dependent
+ * (two equal distances along a line) still counts. The analysis is kept
+ * until the next edit. Asking for one component does not relink either;
+ * with the link outdated, components are numbered in constraint slot order,
+ * as a full relink numbers them.
+ * @param skt Sketch
+ * @param component Index below ffSketch_ComponentCount, or FF_INVALID_INDEX for
+ *        the whole sketch (which also counts parameters no constraint uses)
+ * @return Remaining DOF, 0 if fully constrained (or for a bad index)
+ */
+FF_API uint16_t ffSketch_DegreesOfFreedom(ff_Sketch* skt, uint16_t component);
+
+/**
+ * @brief Get the parameters the constraints leave structurally free
+ *
+ * Those of the under-determined part of the structural analysis (see
+ * ffSketch_DegreesOfFreedom): any of them may move, and a component with
+ * k DOF lists at least k. Parameters no constraint uses are included.
+ * @param skt Sketch
+ * @param out Receives up to cap handles (may be NULL if cap is 0)
+ * @param cap Capacity of out
+ * @return Number of free parameters
+ */
+FF_API uint16_t ffSketch_FreeParameters(ff_Sketch* skt, ff_ParamHandle* out, uint16_t cap);
+
+/**
+ * @brief Get the constraints that structurally over-determine the sketch
+ *
+ * Those of the over-determined part of the structural analysis (see
+ * ffSketch_DegreesOfFreedom): more constraints than the parameters they
+ * share, so dropping one of them is needed for a generic solution. Only the
+ * structure is looked at; see ffSketch_DependentConstraints for what a solve
+ * found numerically.
+ * @param skt Sketch
+ * @param out Receives up to cap handles (may be NULL if cap is 0)
+ * @param cap Capacity of out
+ * @return Number of over-determining constraints
+ */
+FF_API uint16_t ffSketch_OverdeterminingConstraints(ff_Sketch* skt, ff_ConstraintHandle* out, uint16_t cap);
+
+/** @brief Get default solver configuration */
+FF_API ff_SolverConfig ff_SolverConfig_DEFAULT();
+
 /** @brief Get default parameter definition */
 FF_API ff_ParameterDef ff_ParameterDef_DEFAULT();
 
@@ -618,11 +1244,61 @@ FF_API ff_Expr* expr_derivative(ff_Expr* expr, ff_ParamHandle indp_param, bool p
 
 #ifdef FF_FREEFORM_IMPL_
 
+#include <stdio.h>
+#include <math.h>
+
+/* AVX2/FMA paths for the dense kernels; build with -mavx2 -mfma (or
+   -march=native) to enable them, or define FF_NO_SIMD to force scalar code. */
+#if defined(__AVX2__) && defined(__FMA__) && !defined(FF_NO_SIMD)
+#include <immintrin.h>
+#define FF_SIMD_AVX2 1
+#else
+#define FF_SIMD_AVX2 0
+#endif
+
+/* Concurrent component solves (config.threads) use POSIX threads; link with
+   -pthread, or define FF_NO_THREADS to always solve on the calling thread. */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(FF_NO_THREADS)
+#include <pthread.h>
+#define FF_THREADS 1
+#else
+#define FF_THREADS 0
+#endif
+
+/* Wall clock of ffSketch_SolveTimed, in microseconds: the POSIX monotonic
+   clock when <time.h> exposes it (not under a strict -std=c11 without
+   _POSIX_C_SOURCE), else C11 timespec_get, else processor time. */
+#include <time.h>
+#if defined(CLOCK_MONOTONIC)
+static uint64_t ff__NowUs(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000u + (uint64_t)t.tv_nsec / 1000u;
+}
+#elif defined(TIME_UTC)
+static uint64_t ff__NowUs(void) {
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return (uint64_t)t.tv_sec * 1000000u + (uint64_t)t.tv_nsec / 1000u;
+}
+#else
+static uint64_t ff__NowUs(void) {
+    return (uint64_t)clock() * 1000000u / CLOCKS_PER_SEC;
+}
+#endif
+
 #pragma region General
 static int ff_ERROR(const char* msg) {
     printf("FreeForm Critical Error: \'%s\'\n", msg);
     exit(1);
 }
+
+/* Per-iteration solver tracing. Define FF_SOLVER_VERBOSE to enable. */
+#ifdef FF_SOLVER_VERBOSE
+#define FF_LOG(...) printf(__VA_ARGS__)
+#else
+#define FF_LOG(...) ((void)0)
+#endif
 #pragma endregion
 
 
@@ -737,6 +1413,10 @@ static int ff_ERROR(const char* msg) {
         obj.JMR.err = 0.0;
         obj.JMR.dervs = NULL;
         obj.JMR.dervs_y = NULL;
+        obj.JMR.dervs_col = NULL;
+        obj.JMR.dervs_param = NULL;
+        obj.JMR.dervs_of = NULL;
+        obj.JMR.dervs_cnt = 0;
 
         return obj;
     }
@@ -757,13 +1437,41 @@ static int ff_ERROR(const char* msg) {
 #pragma region Type Defaults/Validity
 
 
+ff_SolverConfig ff_SolverConfig_DEFAULT() {
+    ff_SolverConfig cfg;
+    cfg.linear           = FF_LINEAR_AUTO;
+    cfg.normal_form      = FF_NORMAL_AUTO;
+    cfg.precond          = FF_PRECOND_JACOBI;
+    cfg.dense_max_rows   = 1024;
+    cfg.krylov_max_iters = 0;
+    cfg.forcing_max      = 0.1;
+    cfg.jacobian_update  = FF_JACOBIAN_EXACT;
+    cfg.jacobian_max_reuse = 8;
+    cfg.jacobian_stall   = 0.5;
+    cfg.precision        = FF_PRECISION_DOUBLE;
+    cfg.refine_max_iters = 10;
+    cfg.refine_tol       = 1e-12;
+    cfg.backend          = NULL;
+    cfg.reorder          = true;
+    cfg.equilibrate      = FF_EQUIL_ROWS;
+    cfg.detect_dependent = true;
+    cfg.stall_window     = 6;
+    cfg.stall_ratio      = 0.9;
+    cfg.decompose        = true;
+    cfg.triangular       = true;
+    cfg.closed_form      = true;
+    cfg.threads          = 1;
+    return cfg;
+}
+
 ff_ParameterDef ff_ParameterDef_DEFAULT() {
     ff_ParameterDef def;
     def.v = 0.0f;
+    def.scale = 0.0;
     return def;
 }
 bool ff_ParameterDef_IsValid(const ff_ParameterDef def) {
-    (void)def;
+    if (!(def.scale >= 0.0)) return false;
     return true;
 }
 
@@ -834,30 +1542,102 @@ bool ff_ConstraintDef_IsValid(const ff_ConstraintDef def) {
 
 #pragma region High Level Handles
 
+static void ffConstraint__FreeDervs(ff_Constraint* cons) {
+    if (cons->JMR.dervs) {
+        for (uint16_t d = 0; d < cons->JMR.dervs_cnt; d++) {
+            expr_free(cons->JMR.dervs[d]);
+        }
+        free(cons->JMR.dervs);
+    }
+    free(cons->JMR.dervs_param);
+
+    cons->JMR.dervs     = NULL;
+    cons->JMR.dervs_y   = NULL;
+    cons->JMR.dervs_col = NULL;
+    cons->JMR.dervs_param = NULL;
+    cons->JMR.dervs_of  = NULL;
+    cons->JMR.dervs_cnt = 0;
+}
+
+// Edit tracking for a split sketch: an edit marks the components it touches
+// and relink redoes only those (see ffSketch__RelinkEdited). Slot labels
+// follow table growth, new slots belonging to no component yet.
+static void ffSketch__TouchComponent(ff_Sketch* skt, uint16_t comp) {
+    if (skt->comp_dirty && comp < skt->comp_count) skt->comp_dirty[comp] = true;
+}
+
+static void ff__GrowLabels(uint16_t** lab, uint16_t old_cap, uint16_t cap) {
+    if (!*lab || cap == old_cap) return;
+    *lab = realloc(*lab, sizeof(uint16_t) * cap);
+    for (uint16_t i = old_cap; i < cap; i++) (*lab)[i] = FF_INVALID_INDEX;
+}
+
+// A new constraint joins the components of the parameters it uses.
+static void ffExpr__TouchComponents(const ff_Expr* expr, ff_Sketch* skt) {
+    if (!expr) return;
+    if (expr->op_type == OperatorType_PARAM) {
+        if (skt->param_part && ff_paramTBL_alive(&skt->params, expr->param_H)) ffSketch__TouchComponent(skt, skt->param_part[expr->param_H.idx]);
+        return;
+    }
+    ffExpr__TouchComponents(expr->a, skt);
+    if (expr->op_type != OperatorType_EXTR_PARAM) ffExpr__TouchComponents(expr->b, skt);
+}
+
 ff_ParamHandle      ffSketch_AddParameter    (ff_Sketch* skt, const ff_ParameterDef  p_def) {
-    if (!ff_ParameterDef_IsValid(p_def)) return ff_param_INVALIDHANDLE;
+    if (!ff_ParameterDef_IsValid(p_def) || skt->job) return ff_param_INVALIDHANDLE;
     ff_Parameter param = (ff_Parameter) { .def = p_def };
-    return ff_paramTBL_create(&skt->params, &param);
+    skt->link_outdated = true;
+    skt->dof_outdated  = true;
+    const uint16_t cap = skt->params.cap;
+    const ff_ParamHandle h = ff_paramTBL_create(&skt->params, &param);
+    ff__GrowLabels(&skt->param_part, cap, skt->params.cap);
+    return h;
 }
 ff_EntityHandle     ffSketch_AddEntity       (ff_Sketch* skt, const ff_EntityDef     e_def) {
-    if (!ff_EntityDef_IsValid(e_def)) return ff_entity_INVALIDHANDLE;
+    if (!ff_EntityDef_IsValid(e_def) || skt->job) return ff_entity_INVALIDHANDLE;
     ff_Entity ent = (ff_Entity) { .def = e_def };
     return ff_entityTBL_create(&skt->entities, &ent);
 }
 ff_ConstraintHandle ffSketch_AddConstraint   (ff_Sketch* skt, const ff_ConstraintDef c_def) {
-    if (!ff_ConstraintDef_IsValid(c_def)) return ff_constraint_INVALIDHANDLE;
+    if (!ff_ConstraintDef_IsValid(c_def) || skt->job) return ff_constraint_INVALIDHANDLE;
     ff_Constraint cons = (ff_Constraint) { .def = c_def, .JMR = {0} };
-    return ff_constraintTBL_create(&skt->constraints, &cons);
+    skt->link_outdated = true;
+    skt->dof_outdated  = true;
+    const uint16_t cap = skt->constraints.cap;
+    const ff_ConstraintHandle h = ff_constraintTBL_create(&skt->constraints, &cons);
+    ff__GrowLabels(&skt->cons_part, cap, skt->constraints.cap);
+    if (h.idx != FF_INVALID_INDEX && skt->cons_part) {
+        skt->cons_part[h.idx] = FF_INVALID_INDEX;
+        ffExpr__TouchComponents(c_def.eq, skt);
+    }
+    return h;
 }
 
 bool ffSketch_DeleteParameter(ff_Sketch* skt, ff_ParamHandle h) {
-    return ff_paramTBL_destroy(&skt->params, h);
+    if (skt->job || !ff_paramTBL_destroy(&skt->params, h)) return false;
+    skt->link_outdated = true;
+    skt->dof_outdated  = true;
+    if (skt->param_part) {
+        ffSketch__TouchComponent(skt, skt->param_part[h.idx]);
+        skt->param_part[h.idx] = FF_INVALID_INDEX;
+    }
+    return true;
 }
 bool ffSketch_DeleteEntity(ff_Sketch* skt, ff_EntityHandle h) {
-    return ff_entityTBL_destroy(&skt->entities, h);
+    return !skt->job && ff_entityTBL_destroy(&skt->entities, h);
 }
 bool ffSketch_DeleteConstraint(ff_Sketch* skt, ff_ConstraintHandle h) {
-    return ff_constraintTBL_destroy(&skt->constraints, h);
+    ff_Constraint* cons = ffSketch_GetConstraint(skt, h);
+    if (!cons || skt->job) return false;
+    ffConstraint__FreeDervs(cons);
+    ff_constraintTBL_destroy(&skt->constraints, h);
+    skt->link_outdated = true;
+    skt->dof_outdated  = true;
+    if (skt->cons_part) {
+        ffSketch__TouchComponent(skt, skt->cons_part[h.idx]);
+        skt->cons_part[h.idx] = FF_INVALID_INDEX;
+    }
+    return true;
 }
 
 ff_Parameter* ffSketch_GetParameter(ff_Sketch* skt, ff_ParamHandle h) {
@@ -885,6 +1665,11 @@ const ff_Constraint* ffSketch_GetConstraint_Protected(const ff_Sketch* skt, ff_C
     return ff_constraintTBL_get_const(&skt->constraints, h);
 }
 bool ffConstraint_Equals(ff_ConstraintHandle a, ff_ConstraintHandle b) { return ffGenHandle_Equals(a,b); }
+// Handle of the constraint in row r of the linked system.
+static ff_ConstraintHandle ffSketch__RowHandle(const ff_Sketch* skt, uint16_t r) {
+    const uint16_t idx = skt->cons_slot[r];
+    return (ff_ConstraintHandle){ .idx = idx, .gen = skt->constraints.slots[idx].gen };
+}
 
 
 
@@ -934,7 +1719,6 @@ ff_Expr* exprInit_const(ff_float value) {
     expr->op_type = OperatorType_CONST;
     expr->value = value;
     expr->a = expr->b = NULL;
-    expr->param_H = ff_param_INVALIDHANDLE;
     return expr;
 }
 
@@ -1207,296 +1991,4377 @@ void ffSketch_Init(ff_Sketch* skt, uint16_t p_cap, uint16_t e_cap, uint16_t c_ca
 
     skt->link_outdated = true;
 
+    skt->config = ff_SolverConfig_DEFAULT();
+    memset(&skt->stats, 0, sizeof(skt->stats));
+
     skt->normal_mtr     = NULL;
+    skt->normal_f       = NULL;
+    skt->normal_single  = false;
+    skt->normal_tiny    = 0.0;
+    skt->normal_skip    = NULL;
+    skt->normal_dim     = 0;
+    skt->dense_jac      = NULL;
+    skt->dense_jac_cap  = 0;
     skt->itrm_sol       = NULL;
     skt->cached_params  = NULL;
+    skt->scratch        = NULL;
+    skt->scale          = NULL;
+    skt->dependent      = NULL;
+    skt->dependent_perm = NULL;
+    skt->solve_state.factored = false;
+    skt->broyden        = NULL;
+    skt->broyden_cap    = 0;
+    skt->param_cols     = NULL;
+    skt->struct_rank    = 0;
+    skt->match_row      = NULL;
+    skt->jac_map        = NULL;
+    skt->jac_rowptr     = NULL;
+    skt->jac_col        = NULL;
+    skt->jac_val        = NULL;
+    skt->jac_nnz        = 0;
+    skt->analyzed       = NULL;
+    memset(&skt->jac_csc, 0, sizeof(skt->jac_csc));
+    memset(&skt->lu, 0, sizeof(skt->lu));
+    memset(&skt->small, 0, sizeof(skt->small));
+    memset(&skt->band, 0, sizeof(skt->band));
+    memset(&skt->sym, 0, sizeof(skt->sym));
+    memset(&skt->paused, 0, sizeof(skt->paused));
 
     skt->tmp_contraints = NULL;
     skt->tmp_params     = NULL;
+    skt->cons_slot      = NULL;
+    skt->param_slot     = NULL;
+
+    skt->parts      = NULL;
+    skt->part_count = 0;
+    skt->comp_count = 0;
+    skt->comp_ptr   = NULL;
+    skt->comp_stats = NULL;
+    skt->comp_dirty = NULL;
+    skt->link_triangular = false;
+    skt->cons_part  = NULL;
+    skt->param_part = NULL;
+    skt->owner      = NULL;
+    skt->active     = NULL;
+    skt->dof_outdated = true;
+    skt->dof_total  = 0;
+    skt->dof_cons   = NULL;
+    skt->dof_param  = NULL;
+    skt->dof        = NULL;
+    skt->dof_comps  = 0;
+    skt->drag       = NULL;
+    skt->drag_to    = NULL;
+    skt->drag_count = 0;
+    skt->resume_block = NULL;
+    skt->resume_steps = NULL;
+    skt->resume_carry = NULL;
+    skt->job        = NULL;
 }
 
 
-static inline void ffSketch_FreeToBaseState(ff_Sketch* skt) {
-
-    uint16_t  rows = skt->constraints.alive_count;
-    uint16_t  cols = skt->params.alive_count;
-
-    for (uint16_t i = 0; i < skt->constraints.cap; i++) {
-        if (skt->constraints.slots[i].alive) {
-            ff_Constraint* cons = &skt->constraints.slots[i].payload;
-
-            if (cons->JMR.dervs) {
-                for (uint16_t i = 0; i < skt->params.alive_count; i++) {
-                    expr_free(cons->JMR.dervs[i]);
-                }
-                free(cons->JMR.dervs);
-            }
-            if (cons->JMR.dervs_y) free(cons->JMR.dervs_y);
+static void ffCsc__Free(ff_CscMatrix* m) {
+    free(m->p);
+    free(m->i);
+    free(m->x);
+    memset(m, 0, sizeof(*m));
+}
 
-        }
-    }
+static void ffBand__Free(ff_BandFactor* bf) {
+    free(bf->a);
+    free(bf->skip);
+    memset(bf, 0, sizeof(*bf));
+}
 
-    for (uint16_t i = 0; i < skt->params.cap; i++) {
-        if (skt->params.slots[i].alive) {
-            ff_Parameter* param = &skt->params.slots[i].payload;
-            
+static void ffLU__Free(ff_SparseLU* lu) {
+    ffCsc__Free(&lu->L);
+    ffCsc__Free(&lu->U);
+    free(lu->pinv);
+    free(lu->x);
+    free(lu->iw);
+    free(lu->mark);
+    memset(lu, 0, sizeof(*lu));
+}
 
-        }
-    }
+static inline void ffSketch_FreeToBaseState(ff_Sketch* skt) {
 
     //normal mat, intermdeiat esol
     if (skt->normal_mtr) free(skt->normal_mtr);
+    if (skt->normal_f) free(skt->normal_f);
+    if (skt->normal_skip) free(skt->normal_skip);
+    if (skt->dense_jac) free(skt->dense_jac);
     if (skt->itrm_sol) free(skt->itrm_sol);
     if (skt->cached_params) free(skt->cached_params);
+    if (skt->scratch) free(skt->scratch);
+    if (skt->scale) free(skt->scale);
+    if (skt->dependent) free(skt->dependent);
+    if (skt->dependent_perm) free(skt->dependent_perm);
+    if (skt->broyden) free(skt->broyden);
+    if (skt->param_cols && !skt->owner) free(skt->param_cols);
+    if (skt->jac_rowptr) free(skt->jac_rowptr);
+    if (skt->jac_col) free(skt->jac_col);
+    if (skt->jac_val) free(skt->jac_val);
+    ffBand__Free(&skt->band);
     
     if (skt->tmp_contraints) free(skt->tmp_contraints);
     if (skt->tmp_params) free(skt->tmp_params);
+    if (skt->cons_slot) free(skt->cons_slot);
+    if (skt->param_slot) free(skt->param_slot);
 
     skt->normal_mtr = NULL;
+    skt->normal_f = NULL;
+    skt->normal_single = false;
+    skt->normal_skip = NULL;
+    skt->normal_dim = 0;
+    skt->dense_jac = NULL;
+    skt->dense_jac_cap = 0;
     skt->itrm_sol = NULL;
     skt->cached_params = NULL;
+    skt->scratch = NULL;
+    skt->scale = NULL;
+    skt->dependent = NULL;
+    skt->dependent_perm = NULL;
+    skt->solve_state.factored = false;
+    skt->broyden = NULL;
+    skt->broyden_cap = 0;
+    skt->param_cols = NULL;
+    skt->jac_rowptr = NULL;
+    skt->jac_col = NULL;
+    skt->jac_val = NULL;
+    skt->jac_nnz = 0;
 
     skt->tmp_contraints = NULL;
     skt->tmp_params = NULL;
+    skt->cons_slot = NULL;
+    skt->param_slot = NULL;
 }
 
+// Releases everything tied to the Jacobian pattern (see ff_Symbolic). Relink
+// calls this only when the pattern changed.
+static void ffSketch__DropSymbolic(ff_Sketch* skt) {
+    ff_Symbolic* sym = &skt->sym;
+    free(sym->rowptr);
+    free(sym->col);
+    free(sym->col_new);
+    free(sym->row_order);
+    memset(sym, 0, sizeof(*sym));
+
+    if (skt->match_row) free(skt->match_row);
+    if (skt->jac_map) free(skt->jac_map);
+    ffCsc__Free(&skt->jac_csc);
+    ffLU__Free(&skt->lu);
+
+    skt->match_row   = NULL;
+    skt->jac_map     = NULL;
+    skt->struct_rank = 0;
+    skt->analyzed    = NULL;
+}
+
+
+
 
 
+// Releases parts keep..part_count-1.
+static void ffSketch__DropParts(ff_Sketch* skt, uint16_t keep) {
+    for (uint16_t k = keep; k < skt->part_count; k++) {
+        ffSketch_FreeToBaseState(&skt->parts[k]);
+        ffSketch__DropSymbolic(&skt->parts[k]);
+    }
+    skt->part_count = keep;
+    skt->active     = NULL;
+    if (!keep) {
+        free(skt->parts);
+        skt->parts = NULL;
+    }
+}
 
+// Forgets a paused ffSketch_SolveTimed.
+static void ffSketch__DropResume(ff_Sketch* skt) {
+    free(skt->resume_block);
+    free(skt->resume_steps);
+    free(skt->resume_carry);
+    skt->resume_block = NULL;
+    skt->resume_steps = NULL;
+    skt->resume_carry = NULL;
+}
 
 void ffSketch_Free(ff_Sketch* skt) {
 
+    if (skt->job) ffSolveJob_Cancel(skt->job);
+    if (!skt->owner) ffSketch_EndDrag(skt);
+    ffSketch__DropResume(skt);
+
+    //derivatives outlive relinks; a part's belong to the owner's constraints and go with the owner's
+    for (uint16_t i = 0; !skt->owner && i < skt->constraints.cap; i++) {
+        if (skt->constraints.slots[i].alive) ffConstraint__FreeDervs(&skt->constraints.slots[i].payload);
+    }
     ffSketch_FreeToBaseState(skt);
+    ffSketch__DropSymbolic(skt);
+    ffSketch__DropParts(skt, 0);
+    free(skt->cons_part);
+    free(skt->param_part);
+    free(skt->comp_ptr);
+    free(skt->comp_stats);
+    free(skt->comp_dirty);
+    free(skt->dof_cons);
+    free(skt->dof_param);
+    free(skt->dof);
+    skt->cons_part  = NULL;
+    skt->param_part = NULL;
+    skt->comp_ptr   = NULL;
+    skt->comp_stats = NULL;
+    skt->comp_dirty = NULL;
+    skt->dof_cons   = NULL;
+    skt->dof_param  = NULL;
+    skt->dof        = NULL;
 
     ff_paramTBL_free(&skt->params);
     ff_entityTBL_free(&skt->entities);
     ff_constraintTBL_free(&skt->constraints);
 }
 
-//todo add this to ff api?
-static void ffSketch_tryRelink(ff_Sketch* skt) {
-    if (!skt->link_outdated) return;
+// Jacobian column of a parameter slot, or FF_INVALID_INDEX if it is not one of
+// the sketch's columns. Parts share their owner's slot -> column map, so an
+// entry only counts if the column points back at the slot.
+static inline uint16_t ffSketch__ParamCol(const ff_Sketch* skt, uint16_t slot) {
+    const uint16_t col = skt->param_cols[slot];
+    if (col >= skt->params.alive_count || skt->tmp_params[col] != &skt->params.slots[slot].payload) return FF_INVALID_INDEX;
+    return col;
+}
 
-    ffSketch_FreeToBaseState(skt);
+// Collect the distinct Jacobian columns referenced by an expression.
+// `mark` must be all-false on entry; entries set here are cleared by the caller.
+static void ffExpr__CollectCols(const ff_Expr* expr, const ff_Sketch* skt, bool* mark, uint16_t* cols, uint16_t* cnt) {
+    if (!expr) return;
+    if (expr->op_type == OperatorType_PARAM) {
+        if (!ff_paramTBL_alive(&skt->params, expr->param_H)) return;
+        uint16_t col = ffSketch__ParamCol(skt, expr->param_H.idx);
+        if (col == FF_INVALID_INDEX || mark[col]) return;
+        mark[col] = true;
+        cols[(*cnt)++] = col;
+        return;
+    }
+    ffExpr__CollectCols(expr->a, skt, mark, cols, cnt);
+    if (expr->op_type != OperatorType_EXTR_PARAM) ffExpr__CollectCols(expr->b, skt, mark, cols, cnt);
+}
 
-    uint16_t  eq_cnt = skt->constraints.alive_count;
-    uint16_t  par_cnt = skt->params.alive_count;
+// Maximum matching between the rows and columns of a row-compressed pattern
+// (augmenting paths with an explicit DFS stack). row_match/col_match receive
+// the partner or FF_INVALID_INDEX. Returns the matching size, i.e. the
+// structural rank of the matrix.
+static uint16_t ff__MatchRows(const uint32_t* rowptr, const uint16_t* colidx, uint16_t rows, uint16_t cols, uint16_t* row_match, uint16_t* col_match) {
+    uint32_t* visit = calloc(rows ? rows : 1, sizeof(uint32_t));
+    uint16_t* stack = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    uint16_t* pos   = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    uint16_t* via   = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    uint16_t  size  = 0;
+
+    for (uint16_t r = 0; r < rows; r++) row_match[r] = FF_INVALID_INDEX;
+    for (uint16_t c = 0; c < cols; c++) col_match[c] = FF_INVALID_INDEX;
+
+    //greedy pass settles most rows without searching
+    for (uint16_t r = 0; r < rows; r++) {
+        for (uint32_t k = rowptr[r]; k < rowptr[r + 1]; k++) {
+            uint16_t c = colidx[k];
+            if (col_match[c] == FF_INVALID_INDEX) { col_match[c] = r; row_match[r] = c; size++; break; }
+        }
+    }
 
-    skt->tmp_contraints = malloc(sizeof(ff_Constraint*)     * eq_cnt);
-    skt->tmp_params     = malloc(sizeof(ff_ParamHandle*)    * par_cnt);
-    
-    uint16_t _c = 0;
-    for (uint16_t consIdx = 0; consIdx < skt->constraints.cap; consIdx++) {
-        if (skt->constraints.slots[consIdx].alive) {
-            ff_Constraint* cons = &skt->constraints.slots[consIdx].payload;
-            skt->tmp_contraints[_c++] = cons;
+    for (uint16_t root = 0; root < rows; root++) {
+        if (row_match[root] != FF_INVALID_INDEX) continue;
+
+        uint32_t stamp = (uint32_t)root + 1;
+        int top = 0;
+        stack[0] = root; pos[0] = 0; visit[root] = stamp;
+
+        while (top >= 0) {
+            const uint32_t p = rowptr[stack[top]] + pos[top];
+            if (p >= rowptr[stack[top] + 1]) { top--; continue; }
+            pos[top]++;
+
+            uint16_t c = colidx[p];
+            uint16_t owner = col_match[c];
+            if (owner == FF_INVALID_INDEX) {
+                //augment: every row on the stack takes the column it descended through
+                via[top] = c;
+                for (int i = top; i >= 0; i--) {
+                    row_match[stack[i]] = via[i];
+                    col_match[via[i]]   = stack[i];
+                }
+                size++;
+                break;
+            }
+            if (visit[owner] == stamp) continue;
+            visit[owner] = stamp;
+            via[top] = c;
+            top++;
+            stack[top] = owner; pos[top] = 0;
+        }
+    }
+
+    free(visit);
+    free(stack);
+    free(pos);
+    free(via);
+    return size;
+}
+
+// Column-compressed pattern of J plus a map from each row-major nonzero to its
+// CSC slot, so refreshing the values each iteration is a single scatter.
+static void ffSketch__BuildJacCsc(ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    ff_CscMatrix* m = &skt->jac_csc;
+    uint32_t nnz = 0;
+    for (uint16_t r = 0; r < rows; r++) nnz += skt->tmp_contraints[r]->JMR.dervs_cnt;
+
+    m->n_rows = rows;
+    m->n_cols = cols;
+    m->nnz    = nnz;
+    m->cap    = nnz;
+    m->p      = calloc((size_t)cols + 1, sizeof(uint32_t));
+    m->i      = malloc(sizeof(uint16_t) * (nnz ? nnz : 1));
+    m->x      = malloc(sizeof(ff_float) * (nnz ? nnz : 1));
+    skt->jac_map = malloc(sizeof(uint32_t) * (nnz ? nnz : 1));
+
+    for (uint16_t r = 0; r < rows; r++) {
+        const ff_Constraint* cons = skt->tmp_contraints[r];
+        for (uint16_t k = 0; k < cons->JMR.dervs_cnt; k++) m->p[cons->JMR.dervs_col[k] + 1]++;
+    }
+    for (uint16_t c = 0; c < cols; c++) m->p[c + 1] += m->p[c];
+
+    uint32_t* next = malloc(sizeof(uint32_t) * (cols ? cols : 1));
+    memcpy(next, m->p, sizeof(uint32_t) * cols);
+    uint32_t e = 0;
+    for (uint16_t r = 0; r < rows; r++) {
+        const ff_Constraint* cons = skt->tmp_contraints[r];
+        for (uint16_t k = 0; k < cons->JMR.dervs_cnt; k++) {
+            uint32_t dst = next[cons->JMR.dervs_col[k]]++;
+            m->i[dst] = r;
+            skt->jac_map[e++] = dst;
+        }
+    }
+    free(next);
+}
+
+// J*J^T (rows x rows) gives the minimum-norm step and is singular as soon as
+// rows > cols; J^T*J (cols x cols) gives the least-squares step and is singular
+// when rows < cols. Over-constrained systems use J^T*J only when J can have full
+// column rank: if some parameters are free as well, J^T*J is singular too and
+// eliminating it yields an unbounded basic solution, while J*J^T still keeps the
+// step in the row space of J.
+static enum ff_NormalForm ffSketch__PickNormalForm(const ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    if (skt->config.normal_form != FF_NORMAL_AUTO) return skt->config.normal_form;
+    return (rows > cols && skt->struct_rank == cols) ? FF_NORMAL_JTJ : FF_NORMAL_JJT;
+}
+
+/* Backend selection for FF_LINEAR_AUTO. Systems whose normal matrix fits
+   FF_SMALL_MAX use the fixed-size kernels; normal matrices up to FF_AUTO_TINY
+   are always dense; above that the per-step cost estimates decide (the dense
+   one only up to dense_max_rows, the banded one at any size), assuming
+   FF_AUTO_LSQR_ITERS LSQR iterations per Newton step. */
+#define FF_AUTO_TINY       30
+#define FF_AUTO_LSQR_ITERS 64
+
+// reach[j]: last index of the normal matrix (J^T*J or J*J^T) coupled to j.
+// Returns the half-bandwidth, max(reach[j] - j).
+static uint16_t ffSketch__NormalReach(const ff_Sketch* skt, uint16_t rows, uint16_t cols, bool jtj, uint16_t* reach) {
+    const uint16_t n = jtj ? cols : rows;
+    for (uint16_t j = 0; j < n; j++) reach[j] = j;
+    if (jtj) {
+        //columns a <= b are coupled when a row holds both; rows are sorted, so its last column is the farthest
+        for (uint16_t r = 0; r < rows; r++) {
+            const uint32_t p0 = skt->jac_rowptr[r], p1 = skt->jac_rowptr[r + 1];
+            if (p0 == p1) continue;
+            const uint16_t last = skt->jac_col[p1 - 1];
+            for (uint32_t p = p0; p < p1; p++) if (reach[skt->jac_col[p]] < last) reach[skt->jac_col[p]] = last;
+        }
+    } else {
+        //rows i <= j are coupled when they share a column: the last row using each column is the farthest
+        uint16_t* last_row = calloc(cols ? cols : 1, sizeof(uint16_t));
+        for (uint16_t r = 0; r < rows; r++)
+            for (uint32_t p = skt->jac_rowptr[r]; p < skt->jac_rowptr[r + 1]; p++) last_row[skt->jac_col[p]] = r;
+        for (uint16_t r = 0; r < rows; r++)
+            for (uint32_t p = skt->jac_rowptr[r]; p < skt->jac_rowptr[r + 1]; p++)
+                if (reach[r] < last_row[skt->jac_col[p]]) reach[r] = last_row[skt->jac_col[p]];
+        free(last_row);
+    }
+    uint16_t band = 0;
+    for (uint16_t j = 0; j < n; j++) if (reach[j] - j > band) band = (uint16_t)(reach[j] - j);
+    return band;
+}
+
+// Size and fill of J and of the normal matrix the dense backend would build,
+// plus the dense/banded/LSQR cost estimates (stored in skt->stats). The normal
+// matrix is measured by its envelope, which bounds what the dense Cholesky
+// touches: height of column j = last row i >= j with a nonzero (i, j). The
+// banded backend's bandwidths of both normal forms are kept in skt->band.
+static void ffSketch__MeasureJacobian(ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    ff_SolveStats* st = &skt->stats;
+    const uint32_t nnz = skt->jac_nnz;
+    const bool jtj = ffSketch__PickNormalForm(skt, rows, cols) == FF_NORMAL_JTJ;
+    const uint16_t n = jtj ? cols : rows;
+
+    uint16_t* reach = malloc(sizeof(uint16_t) * ((rows > cols ? rows : cols) + 1));
+    const uint16_t other = ffSketch__NormalReach(skt, rows, cols, !jtj, reach);
+    const uint16_t band  = ffSketch__NormalReach(skt, rows, cols, jtj, reach);
+    skt->band.band_jtj = jtj ? band : other;
+    skt->band.band_jjt = jtj ? other : band;
+
+    ff_float env = 0.0, factor = 0.0, band_factor = 0.0;
+    uint16_t far = 0; //envelope is monotone: a column reaches at least as far as the ones before it
+    for (uint16_t j = 0; j < n; j++) {
+        if (reach[j] > far) far = reach[j];
+        const ff_float h = (ff_float)(far - j + 1);
+        const ff_float m = (ff_float)(band < n - 1 - j ? band : n - 1 - j) + 1.0;
+        env    += h;
+        factor += h * h;
+        band_factor += m * m;
+    }
+    free(reach);
+
+    st->rows        = rows;
+    st->cols        = cols;
+    st->nnz         = nnz;
+    st->density     = (rows && cols) ? (ff_float)nnz / ((ff_float)rows * cols) : 0.0;
+    st->normal_dim  = n;
+    st->normal_fill = n ? env / (0.5 * (ff_float)n * (n + 1)) : 0.0;
+    st->normal_band = band;
+    //dense: building, zeroing and two triangular solves are ~n^2, the Cholesky follows the envelope
+    st->dense_cost  = 3.0 * (ff_float)n * n + factor;
+    //banded: the same passes over n*(b+1) entries, the Cholesky over the full band
+    st->band_cost   = 3.0 * (ff_float)n * (band + 1) + band_factor;
+    //LSQR: one J*v and one J^T*v plus a handful of vector updates per iteration
+    st->lsqr_cost   = FF_AUTO_LSQR_ITERS * (4.0 * nnz + 3.0 * rows + 8.0 * cols);
+}
+
+// Breadth-first sweep of the column graph (two columns are adjacent when a row
+// holds both) from `start`, over columns not yet stamped `s`. Each column's new
+// neighbours are queued by ascending degree, as Cuthill-McKee prescribes. The
+// sweep is appended to order[*len]; returns where its last level begins.
+static uint32_t ff__BandSweep(const uint32_t* rowptr, const uint16_t* col, const uint32_t* cptr, const uint16_t* crow,
+                              const uint32_t* degree, uint16_t start, uint32_t* stamp, uint32_t s, uint16_t* order, uint32_t* len) {
+    uint32_t head = *len, level = *len;
+    order[(*len)++] = start;
+    stamp[start] = s;
+    uint32_t level_end = *len;
+    while (head < *len) {
+        if (head == level_end) { level = head; level_end = *len; }
+        const uint16_t c = order[head++];
+        const uint32_t first = *len;
+        for (uint32_t p = cptr[c]; p < cptr[c + 1]; p++) {
+            const uint16_t r = crow[p];
+            for (uint32_t q = rowptr[r]; q < rowptr[r + 1]; q++) {
+                if (stamp[col[q]] == s) continue;
+                stamp[col[q]] = s;
+                order[(*len)++] = col[q];
+            }
+        }
+        for (uint32_t i = first + 1; i < *len; i++) {
+            uint16_t v = order[i];
+            uint32_t j = i;
+            while (j > first && degree[order[j - 1]] > degree[v]) { order[j] = order[j - 1]; j--; }
+            order[j] = v;
+        }
+    }
+    return level;
+}
+
+// Reverse Cuthill-McKee order of the Jacobian columns, then rows by their first
+// column in that order. Each connected part is swept from a pseudo-peripheral
+// column (lowest degree in the last level of a trial sweep). Chains, linkages
+// and polylines come out with a narrow band in J, J^T*J and J*J^T alike.
+// col_new[c]: new index of column c; row_order[k]: old row placed at k.
+static void ffSketch__BandOrder(const ff_Sketch* skt, uint16_t rows, uint16_t cols, uint16_t* col_new, uint16_t* row_order) {
+    const uint32_t* rowptr = skt->jac_rowptr;
+    const uint16_t* col    = skt->jac_col;
+    const uint32_t  nnz    = rowptr[rows];
+
+    //column -> rows, and degree ~ entries sharing a row (duplicates counted, cheap and good enough)
+    uint32_t* cptr   = calloc((size_t)cols + 1, sizeof(uint32_t));
+    uint16_t* crow   = malloc(sizeof(uint16_t) * (nnz ? nnz : 1));
+    uint32_t* degree = calloc(cols, sizeof(uint32_t));
+    uint32_t* stamp  = calloc(cols, sizeof(uint32_t));
+    uint16_t* order  = malloc(sizeof(uint16_t) * cols);
+    for (uint32_t p = 0; p < nnz; p++) cptr[col[p] + 1]++;
+    for (uint16_t c = 0; c < cols; c++) cptr[c + 1] += cptr[c];
+    for (uint16_t r = 0; r < rows; r++) {
+        for (uint32_t p = rowptr[r]; p < rowptr[r + 1]; p++) {
+            crow[stamp[col[p]]++ + cptr[col[p]]] = r;
+            degree[col[p]] += rowptr[r + 1] - rowptr[r] - 1;
+        }
+    }
+    memset(stamp, 0, sizeof(uint32_t) * cols);
+
+    for (uint16_t c = 0; c < cols; c++) col_new[c] = FF_INVALID_INDEX;
+    uint32_t len = 0, s = 0;
+    for (uint16_t c0 = 0; c0 < cols; c0++) {
+        if (col_new[c0] != FF_INVALID_INDEX) continue;
+        //trial sweep (written past len, then overwritten by the real one)
+        uint32_t trial = len;
+        const uint32_t last = ff__BandSweep(rowptr, col, cptr, crow, degree, c0, stamp, ++s, order, &trial);
+        uint16_t start = order[last];
+        for (uint32_t k = last + 1; k < trial; k++) if (degree[order[k]] < degree[start]) start = order[k];
+
+        const uint32_t first = len;
+        ff__BandSweep(rowptr, col, cptr, crow, degree, start, stamp, ++s, order, &len);
+        for (uint32_t k = first; k < len; k++) col_new[order[k]] = (uint16_t)k;
+    }
+    for (uint16_t c = 0; c < cols; c++) col_new[c] = (uint16_t)(cols - 1 - col_new[c]);
+
+    //rows by first (new) column; counting sort keeps ties in slot order, rows without columns go last
+    uint32_t* bucket = calloc((size_t)cols + 2, sizeof(uint32_t));
+    uint16_t* key    = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    for (uint16_t r = 0; r < rows; r++) {
+        uint16_t k = cols;
+        for (uint32_t p = rowptr[r]; p < rowptr[r + 1]; p++) if (col_new[col[p]] < k) k = col_new[col[p]];
+        key[r] = k;
+        bucket[k + 1]++;
+    }
+    for (uint32_t k = 0; k <= cols; k++) bucket[k + 1] += bucket[k];
+    for (uint16_t r = 0; r < rows; r++) row_order[bucket[key[r]]++] = r;
+
+    free(cptr);
+    free(crow);
+    free(degree);
+    free(stamp);
+    free(order);
+    free(bucket);
+    free(key);
+}
+
+// Renumbers the packed Jacobian pattern, tmp_contraints, tmp_params, their
+// slots and param_cols into a band order from ffSketch__BandOrder.
+static void ffSketch__ApplyBandOrder(ff_Sketch* skt, uint16_t rows, uint16_t cols,
+                                     const uint16_t* col_new, const uint16_t* row_order) {
+    const uint32_t nnz = skt->jac_rowptr[rows];
+    uint32_t*       rowptr = malloc(sizeof(uint32_t) * ((size_t)rows + 1));
+    uint16_t*       colidx = malloc(sizeof(uint16_t) * (nnz ? nnz : 1));
+    ff_Constraint** cons   = malloc(sizeof(ff_Constraint*) * rows);
+    uint16_t*       cslot  = malloc(sizeof(uint16_t) * rows);
+    uint32_t pos = 0;
+    for (uint16_t k = 0; k < rows; k++) {
+        const uint16_t r = row_order[k];
+        rowptr[k] = pos;
+        cons[k]   = skt->tmp_contraints[r];
+        cslot[k]  = skt->cons_slot[r];
+        for (uint32_t p = skt->jac_rowptr[r]; p < skt->jac_rowptr[r + 1]; p++) {
+            //insertion: rows stay sorted by column
+            uint16_t v = col_new[skt->jac_col[p]];
+            uint32_t j = pos++;
+            while (j > rowptr[k] && colidx[j - 1] > v) { colidx[j] = colidx[j - 1]; j--; }
+            colidx[j] = v;
+        }
+    }
+    rowptr[rows] = pos;
+    free(skt->jac_rowptr);
+    free(skt->jac_col);
+    free(skt->tmp_contraints);
+    free(skt->cons_slot);
+    skt->jac_rowptr     = rowptr;
+    skt->jac_col        = colidx;
+    skt->tmp_contraints = cons;
+    skt->cons_slot      = cslot;
+
+    ff_Parameter** params = malloc(sizeof(ff_Parameter*) * cols);
+    uint16_t*      slots  = malloc(sizeof(uint16_t) * cols);
+    for (uint16_t c = 0; c < cols; c++) {
+        params[col_new[c]] = skt->tmp_params[c];
+        slots[col_new[c]]  = skt->param_slot[c];
+    }
+    for (uint16_t c = 0; c < cols; c++) {
+        skt->tmp_params[c] = params[c];
+        skt->param_slot[c] = slots[c];
+        skt->param_cols[slots[c]] = c;
+    }
+    free(params);
+    free(slots);
+}
+
+// FNV-1a over the slot-order pattern (and whether it gets band-ordered): equal
+// hashes mean the symbolic analysis of the last relink most likely still fits.
+static uint64_t ffSketch__PatternHash(const ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    uint64_t h = 14695981039346656037ull;
+#define FF_HASH(v) (h = (h ^ (uint64_t)(v)) * 1099511628211ull)
+    FF_HASH(rows);
+    FF_HASH(cols);
+    FF_HASH(skt->config.reorder);
+    for (uint16_t r = 0; r < rows; r++) {
+        FF_HASH(skt->jac_rowptr[r + 1] - skt->jac_rowptr[r]);
+        for (uint32_t p = skt->jac_rowptr[r]; p < skt->jac_rowptr[r + 1]; p++) FF_HASH(skt->jac_col[p]);
+    }
+#undef FF_HASH
+    return h ? h : 1;
+}
+
+// Whether the cached symbolic analysis belongs to the pattern just collected
+// (hash first, then the pattern itself); if not, it is dropped and the new
+// pattern recorded, with its band order when config.reorder is set.
+static bool ffSketch__KeepSymbolic(ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    ff_Symbolic* sym = &skt->sym;
+    const uint64_t hash = ffSketch__PatternHash(skt, rows, cols);
+    const uint32_t nnz = skt->jac_rowptr[rows];
+    if (sym->hash == hash && sym->rows == rows && sym->cols == cols && sym->rowptr[rows] == nnz &&
+        !memcmp(sym->rowptr, skt->jac_rowptr, sizeof(uint32_t) * ((size_t)rows + 1)) &&
+        !memcmp(sym->col, skt->jac_col, sizeof(uint16_t) * nnz)) {
+        FF_LOG("Relink: pattern unchanged, keeping symbolic analysis\n");
+        return true;
+    }
+
+    ffSketch__DropSymbolic(skt);
+    sym->hash   = hash;
+    sym->rows   = rows;
+    sym->cols   = cols;
+    sym->rowptr = malloc(sizeof(uint32_t) * ((size_t)rows + 1));
+    sym->col    = malloc(sizeof(uint16_t) * (nnz ? nnz : 1));
+    memcpy(sym->rowptr, skt->jac_rowptr, sizeof(uint32_t) * ((size_t)rows + 1));
+    memcpy(sym->col, skt->jac_col, sizeof(uint16_t) * nnz);
+    if (skt->config.reorder && rows && cols) {
+        sym->col_new   = malloc(sizeof(uint16_t) * cols);
+        sym->row_order = malloc(sizeof(uint16_t) * rows);
+        ffSketch__BandOrder(skt, rows, cols, sym->col_new, sym->row_order);
+    }
+    return false;
+}
+
+// Points every linked constraint's derivative row at its place in the packed
+// Jacobian.
+static void ffSketch__PointRows(ff_Sketch* skt) {
+    for (uint16_t r = 0; r < skt->constraints.alive_count; r++) {
+        skt->tmp_contraints[r]->JMR.dervs_col = skt->jac_col + skt->jac_rowptr[r];
+        skt->tmp_contraints[r]->JMR.dervs_y   = skt->jac_val + skt->jac_rowptr[r];
+    }
+}
+
+// Builds the Newton system of the given constraints and parameters (slot
+// indices, ascending; the alive counts of skt's tables say how many).
+// Parameters outside the list are constants to it.
+static void ffSketch__Link(ff_Sketch* skt, const uint16_t* cons_slots, const uint16_t* param_slots) {
+    ffSketch_FreeToBaseState(skt);
+
+    uint16_t  eq_cnt = skt->constraints.alive_count;
+    uint16_t  par_cnt = skt->params.alive_count;
+
+    skt->tmp_contraints = malloc(sizeof(ff_Constraint*)     * eq_cnt);
+    skt->tmp_params     = malloc(sizeof(ff_ParamHandle*)    * par_cnt);
+    skt->cons_slot      = malloc(sizeof(uint16_t) * (eq_cnt ? eq_cnt : 1));
+    skt->param_slot     = malloc(sizeof(uint16_t) * (par_cnt ? par_cnt : 1));
+    skt->param_cols     = skt->owner ? skt->owner->param_cols : malloc(sizeof(uint16_t) * skt->params.cap);
+
+    //Only parameters an equation actually references get a derivative, so the
+    //Jacobian is stored by rows with memory linear in its nonzero count.
+    bool*     mark     = calloc(par_cnt ? par_cnt : 1, sizeof(bool));
+    uint16_t* cols     = malloc(sizeof(uint16_t) * (par_cnt ? par_cnt : 1));
+    uint32_t  nnz      = 0;
+    uint32_t  nnz_cap  = 4 * (uint32_t)eq_cnt + 16;
+
+    skt->jac_rowptr = malloc(sizeof(uint32_t) * ((size_t)eq_cnt + 1));
+    skt->jac_col    = malloc(sizeof(uint16_t) * nnz_cap);
+
+    //a part writes its own columns into the owner's map, leaving the other parts' entries be
+    if (!skt->owner) for (uint16_t paramIdx = 0; paramIdx < skt->params.cap; paramIdx++) skt->param_cols[paramIdx] = FF_INVALID_INDEX;
+    for (uint16_t _p = 0; _p < par_cnt; _p++) {
+        const uint16_t paramIdx = param_slots[_p];
+        skt->param_cols[paramIdx] = _p;
+        skt->param_slot[_p] = paramIdx;
+        skt->tmp_params[_p] = &skt->params.slots[paramIdx].payload;
+    }
+
+    for (uint16_t _c = 0; _c < eq_cnt; _c++) {
+        ff_Constraint* cons = &skt->constraints.slots[cons_slots[_c]].payload;
+        skt->tmp_contraints[_c] = cons;
+        skt->cons_slot[_c]      = cons_slots[_c];
+
+        uint16_t cnt = 0;
+        ffExpr__CollectCols(cons->def.eq, skt, mark, cols, &cnt);
+        for (uint16_t d = 0; d < cnt; d++) mark[cols[d]] = false;
+
+        //insertion sort: rows are short and ascending columns keep J*v/J^T*v sequential
+        for (uint16_t i = 1; i < cnt; i++) {
+            uint16_t v = cols[i], j = i;
+            while (j > 0 && cols[j - 1] > v) { cols[j] = cols[j - 1]; j--; }
+            cols[j] = v;
+        }
+
+        if (nnz + cnt > nnz_cap) {
+            while (nnz + cnt > nnz_cap) nnz_cap *= 2;
+            skt->jac_col = realloc(skt->jac_col, sizeof(uint16_t) * nnz_cap);
+        }
+        memcpy(skt->jac_col + nnz, cols, sizeof(uint16_t) * cnt);
+        skt->jac_rowptr[_c] = nnz;
+        nnz += cnt;
+    }
+    skt->jac_rowptr[eq_cnt] = nnz;
+
+    //Edits that leave the pattern as it was keep the ordering, matching, LU
+    //structure and backend analysis; only values are recomputed below
+    const bool same = ffSketch__KeepSymbolic(skt, eq_cnt, par_cnt);
+    skt->stats.pattern_reused = same;
+
+    //Columns and rows in slot order follow creation order, not the sketch's
+    //topology; the band order keeps every factorization, J*v and the residual
+    //sweep moving along the chain instead of jumping around
+    if (skt->sym.col_new) ffSketch__ApplyBandOrder(skt, eq_cnt, par_cnt, skt->sym.col_new, skt->sym.row_order);
+
+    //A derivative depends only on the equation and the parameter, so the
+    //ones taken at an earlier relink are kept and only new entries (an added
+    //constraint, a parameter it now uses) are differentiated
+    skt->stats.differentiated = 0;
+    for (uint16_t r = 0; r < eq_cnt; r++) {
+        ff_Constraint* cons = skt->tmp_contraints[r];
+        const uint32_t p0 = skt->jac_rowptr[r];
+        const uint16_t cnt = (uint16_t)(skt->jac_rowptr[r + 1] - p0);
+        const uint16_t old_cnt = cons->JMR.dervs ? cons->JMR.dervs_cnt : 0;
+        const bool     same_eq = cons->JMR.dervs_of == cons->def.eq;
+        ff_Expr**       old       = cons->JMR.dervs;
+        ff_ParamHandle* old_param = cons->JMR.dervs_param;
+
+        cons->JMR.dervs_cnt   = cnt;
+        cons->JMR.dervs       = malloc(sizeof(ff_Expr*) * (cnt ? cnt : 1));
+        cons->JMR.dervs_param = malloc(sizeof(ff_ParamHandle) * (cnt ? cnt : 1));
+        cons->JMR.dervs_of    = cons->def.eq;
+
+        for (uint16_t d = 0; d < cnt; d++) {
+            uint16_t paramIdx = skt->param_slot[skt->jac_col[p0 + d]];
+            ff_ParamHandle pH = (ff_ParamHandle){ .idx = paramIdx, .gen = skt->params.slots[paramIdx].gen };
+
+            uint16_t k = 0;
+            while (same_eq && k < old_cnt && !(old[k] && ffParam_Equals(old_param[k], pH))) k++;
+            if (same_eq && k < old_cnt) {
+                cons->JMR.dervs[d] = old[k];
+                old[k] = NULL;
+            } else {
+                cons->JMR.dervs[d] = expr_derivative(cons->def.eq, pH, true);
+                skt->stats.differentiated++;
+            }
+            cons->JMR.dervs_param[d] = pH;
+        }
+        if (old) {
+            for (uint16_t k = 0; k < old_cnt; k++) if (old[k]) expr_free(old[k]);
+            free(old);
+        }
+        free(old_param);
+    }
+
+    free(mark);
+    free(cols);
+
+    //rows live back to back in one row-compressed array, which is also the
+    //ff_JacobianView handed to linear-solver backends
+    skt->jac_nnz = nnz;
+    skt->jac_val = calloc(nnz ? nnz : 1, sizeof(ff_float));
+    ffSketch__PointRows(skt);
+
+    if (!same) {
+        uint16_t* row_match = malloc(sizeof(uint16_t) * (eq_cnt ? eq_cnt : 1));
+        skt->match_row      = malloc(sizeof(uint16_t) * (par_cnt ? par_cnt : 1));
+        skt->struct_rank = ff__MatchRows(skt->jac_rowptr, skt->jac_col, eq_cnt, par_cnt, row_match, skt->match_row);
+        free(row_match);
+
+        //Square and structurally nonsingular: J is factored directly, so keep a CSC copy of its pattern
+        if (eq_cnt == par_cnt && skt->struct_rank == eq_cnt) ffSketch__BuildJacCsc(skt, eq_cnt, par_cnt);
+    }
+
+    ffSketch__MeasureJacobian(skt, eq_cnt, par_cnt);
+
+    //The dense normal matrix is rows^2 and only allocated once a dense solve needs it.
+    skt->itrm_sol   = malloc(sizeof(ff_float) * (eq_cnt > par_cnt ? eq_cnt : par_cnt));
+    skt->cached_params = malloc(sizeof(ff_float) * par_cnt);
+    skt->scratch    = malloc(sizeof(ff_float) * (5 * (size_t)eq_cnt + 6 * (size_t)par_cnt + 1));
+    skt->scale      = malloc(sizeof(ff_float) * ((size_t)eq_cnt + 2 * (size_t)par_cnt + 1));
+    skt->dependent      = malloc(sizeof(ff_ConstraintHandle) * (eq_cnt ? eq_cnt : 1));
+    skt->dependent_perm = malloc(sizeof(uint16_t) * (eq_cnt ? eq_cnt : 1));
+    skt->stats.redundant   = 0;
+    skt->stats.conflicting = 0;
+    skt->solve_state.rows     = eq_cnt;
+    skt->solve_state.factored = false;
+}
+
+// Collect the distinct live parameter slots referenced by an expression.
+// `mark` (by slot) must be all-false on entry; the caller clears what is set.
+static void ffExpr__CollectSlots(const ff_Expr* expr, const ff_Sketch* skt, bool* mark, uint16_t* slots, uint16_t* cnt) {
+    if (!expr) return;
+    if (expr->op_type == OperatorType_PARAM) {
+        if (!ff_paramTBL_alive(&skt->params, expr->param_H) || mark[expr->param_H.idx]) return;
+        mark[expr->param_H.idx] = true;
+        slots[(*cnt)++] = expr->param_H.idx;
+        return;
+    }
+    ffExpr__CollectSlots(expr->a, skt, mark, slots, cnt);
+    if (expr->op_type != OperatorType_EXTR_PARAM) ffExpr__CollectSlots(expr->b, skt, mark, slots, cnt);
+}
+
+// Structure of the sketch before any linking: one row per live constraint
+// (in slot order, row_slot[r] its slot), or per constraint of the slots[0..n)
+// given, columns are parameter slots. Only the pattern is built, no
+// derivatives.
+typedef struct ff_SlotPattern {
+    uint16_t  rows;
+    uint16_t* row_slot;
+    uint32_t* rowptr;
+    uint16_t* col;
+} ff_SlotPattern;
+
+static void ffSketch__SlotPattern(const ff_Sketch* skt, const uint16_t* only, uint16_t n, ff_SlotPattern* pat) {
+    const uint16_t pcap = skt->params.cap;
+    const uint16_t rows = only ? n : skt->constraints.alive_count;
+    bool*     mark  = calloc(pcap ? pcap : 1, sizeof(bool));
+    uint16_t* slots = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    uint32_t  cap   = 4 * (uint32_t)rows + 16, nnz = 0;
+    pat->rows     = 0;
+    pat->row_slot = malloc(sizeof(uint16_t) * (rows + 1));
+    pat->rowptr   = malloc(sizeof(uint32_t) * ((size_t)rows + 1));
+    pat->col      = malloc(sizeof(uint16_t) * cap);
+    for (uint16_t i = 0; i < (only ? n : skt->constraints.cap); i++) {
+        const uint16_t c = only ? only[i] : i;
+        if (!skt->constraints.slots[c].alive) continue;
+        uint16_t cnt = 0;
+        ffExpr__CollectSlots(skt->constraints.slots[c].payload.def.eq, skt, mark, slots, &cnt);
+        if (nnz + cnt > cap) {
+            while (nnz + cnt > cap) cap *= 2;
+            pat->col = realloc(pat->col, sizeof(uint16_t) * cap);
+        }
+        for (uint16_t k = 0; k < cnt; k++) { mark[slots[k]] = false; pat->col[nnz + k] = slots[k]; }
+        pat->row_slot[pat->rows] = c;
+        pat->rowptr[pat->rows++] = nnz;
+        nnz += cnt;
+    }
+    pat->rowptr[pat->rows] = nnz;
+    free(mark);
+    free(slots);
+}
+
+static void ffSlotPattern__Free(ff_SlotPattern* pat) {
+    free(pat->row_slot);
+    free(pat->rowptr);
+    free(pat->col);
+}
+
+// Union-find root of parameter slot p, halving the path on the way.
+static uint16_t ff__FindRoot(uint16_t* up, uint16_t p) {
+    while (up[p] != p) {
+        up[p] = up[up[p]];
+        p = up[p];
+    }
+    return p;
+}
+
+// Labels the connected components of a pattern's constraint/parameter graph
+// in cons_part and param_part (by slot), numbered from 0 in row order; labels
+// of slots outside the pattern are left alone. Constraints on no parameter at
+// all share one component. Returns the count.
+static uint16_t ffSketch__FindComponents(const ff_Sketch* skt, const ff_SlotPattern* pat, uint16_t* cons_part, uint16_t* param_part) {
+    const uint16_t pcap = skt->params.cap;
+    uint16_t* up    = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    uint16_t* label = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    for (uint16_t p = 0; p < pcap; p++) { up[p] = p; label[p] = FF_INVALID_INDEX; }
+
+    for (uint16_t r = 0; r < pat->rows; r++) {
+        const uint32_t p0 = pat->rowptr[r];
+        for (uint32_t k = p0 + 1; k < pat->rowptr[r + 1]; k++) {
+            const uint16_t a = ff__FindRoot(up, pat->col[p0]), b = ff__FindRoot(up, pat->col[k]);
+            if (a != b) up[b] = a;
+        }
+    }
+
+    uint16_t count = 0, constant = FF_INVALID_INDEX;
+    for (uint16_t r = 0; r < pat->rows; r++) {
+        uint16_t* part = &cons_part[pat->row_slot[r]];
+        if (pat->rowptr[r] == pat->rowptr[r + 1]) {
+            if (constant == FF_INVALID_INDEX) constant = count++;
+            *part = constant;
+            continue;
+        }
+        const uint16_t root = ff__FindRoot(up, pat->col[pat->rowptr[r]]);
+        if (label[root] == FF_INVALID_INDEX) label[root] = count++;
+        *part = label[root];
+    }
+    for (uint32_t k = 0; k < pat->rowptr[pat->rows]; k++) param_part[pat->col[k]] = label[ff__FindRoot(up, pat->col[k])];
+
+    free(up);
+    free(label);
+    return count;
+}
+
+// Sides of the Dulmage-Mendelsohn form of a pattern, from a maximum
+// matching (row_match/col_match, see ff__MatchRows): rows reachable from an
+// unmatched row along alternating paths and their columns are
+// over-determined, columns reachable from an unmatched column and their rows
+// under-determined, the rest square. Columns no row uses stay FF_DM_SQUARE
+// and unmatched. Returns the matching size.
+enum { FF_DM_SQUARE, FF_DM_OVER, FF_DM_UNDER, FF_DM_UNMATCHED };
+static uint16_t ff__DmSides(const ff_SlotPattern* pat, uint16_t pcap, uint16_t* row_match, uint16_t* col_match, uint8_t* row_kind, uint8_t* col_kind) {
+    const uint16_t rows = pat->rows;
+    const uint32_t nnz  = pat->rowptr[rows];
+    const uint16_t size = ff__MatchRows(pat->rowptr, pat->col, rows, pcap, row_match, col_match);
+
+    //column -> rows, for walking from the unmatched columns
+    uint32_t* colptr  = calloc((size_t)pcap + 1, sizeof(uint32_t));
+    uint16_t* colrows = malloc(sizeof(uint16_t) * (nnz ? nnz : 1));
+    for (uint32_t k = 0; k < nnz; k++) colptr[pat->col[k] + 1]++;
+    for (uint16_t p = 0; p < pcap; p++) colptr[p + 1] += colptr[p];
+    for (uint16_t r = 0; r < rows; r++)
+        for (uint32_t k = pat->rowptr[r]; k < pat->rowptr[r + 1]; k++) colrows[colptr[pat->col[k]]++] = r;
+    for (uint16_t p = pcap; p > 0; p--) colptr[p] = colptr[p - 1];
+    colptr[0] = 0;
+
+    uint16_t* queue = malloc(sizeof(uint16_t) * ((size_t)rows + pcap + 1));
+    uint32_t  head = 0, tail = 0;
+    memset(row_kind, FF_DM_SQUARE, rows);
+    memset(col_kind, FF_DM_SQUARE, pcap);
+
+    for (uint16_t r = 0; r < rows; r++) if (row_match[r] == FF_INVALID_INDEX) { row_kind[r] = FF_DM_OVER; queue[tail++] = r; }
+    while (head < tail) {
+        const uint16_t r = queue[head++];
+        for (uint32_t k = pat->rowptr[r]; k < pat->rowptr[r + 1]; k++) {
+            const uint16_t c = pat->col[k], next = col_match[c];
+            col_kind[c] = FF_DM_OVER;
+            if (next != FF_INVALID_INDEX && row_kind[next] != FF_DM_OVER) { row_kind[next] = FF_DM_OVER; queue[tail++] = next; }
+        }
+    }
+    head = tail = 0;
+    for (uint16_t p = 0; p < pcap; p++)
+        if (colptr[p] < colptr[p + 1] && col_match[p] == FF_INVALID_INDEX) { col_kind[p] = FF_DM_UNDER; queue[tail++] = p; }
+    while (head < tail) {
+        const uint16_t c = queue[head++];
+        for (uint32_t k = colptr[c]; k < colptr[c + 1]; k++) {
+            const uint16_t r = colrows[k], next = row_match[r];
+            row_kind[r] = FF_DM_UNDER;
+            if (next != FF_INVALID_INDEX && col_kind[next] != FF_DM_UNDER) { col_kind[next] = FF_DM_UNDER; queue[tail++] = next; }
+        }
+    }
+
+    free(colptr);
+    free(colrows);
+    free(queue);
+    return size;
+}
+
+// Splits every component into the blocks of its Dulmage-Mendelsohn form, in
+// an order each can be solved in with the ones before it held fixed:
+//  - the over-determined part (rows reachable from an unmatched row along
+//    alternating paths) touches only its own columns and goes first;
+//  - the square part, cut into the strongly connected components of "row r
+//    needs the row matched to one of its columns", in topological order;
+//  - the under-determined part (columns reachable from an unmatched column)
+//    last, since its rows may use any column.
+// cons_block/param_block (by slot) receive the block, block_comp the
+// component of each block. Blocks of a component are contiguous. Returns the
+// block count.
+static uint16_t ffSketch__FindBlocks(const ff_Sketch* skt, const ff_SlotPattern* pat, uint16_t comps,
+                                     uint16_t* cons_block, uint16_t* param_block, uint16_t* block_comp) {
+    const uint16_t rows = pat->rows, pcap = skt->params.cap;
+    uint16_t* row_match = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    uint16_t* col_match = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    uint8_t*  row_kind  = malloc(rows ? rows : 1);
+    uint8_t*  col_kind  = malloc(pcap ? pcap : 1);
+    ff__DmSides(pat, pcap, row_match, col_match, row_kind, col_kind);
+
+    //Tarjan over the square rows with explicit stacks; a strongly connected
+    //set is emitted only after every set it depends on, i.e. in solve order
+    uint32_t* index = malloc(sizeof(uint32_t) * (rows ? rows : 1));
+    uint32_t* low   = malloc(sizeof(uint32_t) * (rows ? rows : 1));
+    uint32_t* pos   = malloc(sizeof(uint32_t) * (rows ? rows : 1));
+    uint16_t* call  = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    uint16_t* stack = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    uint16_t* scc   = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    bool*     on    = calloc(rows ? rows : 1, sizeof(bool));
+    uint32_t  counter = 0, sccs = 0;
+    int       depth = 0, top = 0;
+    for (uint16_t r = 0; r < rows; r++) index[r] = UINT32_MAX;
+    for (uint16_t root = 0; root < rows; root++) {
+        if (row_kind[root] != FF_DM_SQUARE || index[root] != UINT32_MAX) continue;
+        call[0] = root; depth = 1;
+        index[root] = low[root] = counter++; pos[root] = pat->rowptr[root];
+        stack[top++] = root; on[root] = true;
+        while (depth) {
+            const uint16_t r = call[depth - 1];
+            if (pos[r] < pat->rowptr[r + 1]) {
+                const uint16_t c = pat->col[pos[r]++];
+                if (c == row_match[r] || col_kind[c] != FF_DM_SQUARE) continue;
+                const uint16_t next = col_match[c];
+                if (index[next] == UINT32_MAX) {
+                    index[next] = low[next] = counter++; pos[next] = pat->rowptr[next];
+                    stack[top++] = next; on[next] = true;
+                    call[depth++] = next;
+                } else if (on[next] && index[next] < low[r]) low[r] = index[next];
+                continue;
+            }
+            if (low[r] == index[r]) {
+                uint16_t m;
+                do { m = stack[--top]; on[m] = false; scc[m] = (uint16_t)sccs; } while (m != r);
+                sccs++;
+            }
+            depth--;
+            if (depth && low[r] < low[call[depth - 1]]) low[call[depth - 1]] = low[r];
+        }
+    }
+
+    //number the blocks: per component its over-determined block, the square
+    //ones in emission order, then its under-determined block
+    uint16_t* comp_of = malloc(sizeof(uint16_t) * (sccs ? sccs : 1));
+    uint16_t* id      = malloc(sizeof(uint16_t) * (sccs ? sccs : 1));
+    uint16_t* count   = calloc((size_t)comps + 1, sizeof(uint16_t));
+    uint16_t* fill    = malloc(sizeof(uint16_t) * (comps ? comps : 1));
+    uint16_t* over    = malloc(sizeof(uint16_t) * (comps ? comps : 1));
+    uint16_t* under   = malloc(sizeof(uint16_t) * (comps ? comps : 1));
+    for (uint16_t k = 0; k < comps; k++) over[k] = under[k] = FF_INVALID_INDEX;
+    for (uint16_t r = 0; r < rows; r++) {
+        const uint16_t comp = skt->cons_part[pat->row_slot[r]];
+        if (row_kind[r] == FF_DM_SQUARE) comp_of[scc[r]] = comp;
+        else if (row_kind[r] == FF_DM_OVER) over[comp] = 0;
+        else under[comp] = 0;
+    }
+    for (uint32_t b = 0; b < sccs; b++) count[comp_of[b] + 1]++;
+    for (uint16_t k = 0; k < comps; k++) count[k + 1] += (over[k] != FF_INVALID_INDEX) + (under[k] != FF_INVALID_INDEX);
+    for (uint16_t k = 0; k < comps; k++) count[k + 1] += count[k];
+    const uint16_t blocks = count[comps];
+    for (uint16_t k = 0; k < comps; k++) {
+        fill[k] = count[k];
+        if (over[k] != FF_INVALID_INDEX) { over[k] = fill[k]++; block_comp[over[k]] = k; }
+        if (under[k] != FF_INVALID_INDEX) { under[k] = count[k + 1] - 1; block_comp[under[k]] = k; }
+    }
+    for (uint32_t b = 0; b < sccs; b++) { id[b] = fill[comp_of[b]]++; block_comp[id[b]] = comp_of[b]; }
+
+    for (uint16_t c = 0; c < skt->constraints.cap; c++) cons_block[c] = FF_INVALID_INDEX;
+    for (uint16_t p = 0; p < pcap; p++) param_block[p] = FF_INVALID_INDEX;
+    for (uint16_t r = 0; r < rows; r++) {
+        const uint16_t comp = skt->cons_part[pat->row_slot[r]];
+        cons_block[pat->row_slot[r]] = row_kind[r] == FF_DM_SQUARE ? id[scc[r]] : row_kind[r] == FF_DM_OVER ? over[comp] : under[comp];
+    }
+    for (uint16_t p = 0; p < pcap; p++) {
+        if (col_match[p] == FF_INVALID_INDEX && col_kind[p] == FF_DM_SQUARE) continue; //in no row
+        const uint16_t comp = skt->param_part[p];
+        param_block[p] = col_kind[p] == FF_DM_SQUARE ? id[scc[col_match[p]]] : col_kind[p] == FF_DM_OVER ? over[comp] : under[comp];
+    }
+
+    free(row_match); free(col_match); free(row_kind); free(col_kind);
+    free(index); free(low); free(pos); free(call); free(stack); free(scc); free(on);
+    free(comp_of); free(id); free(count); free(fill); free(over); free(under);
+    return blocks;
+}
+
+// Slot lists of each part, in slot order: part k owns cons[cptr[k]..cptr[k+1])
+// and params[pptr[k]..pptr[k+1]). Slots labelled FF_INVALID_INDEX are left out.
+static void ffSketch__PartSlots(const ff_Sketch* skt, uint16_t parts, const uint16_t* cons_lab, const uint16_t* param_lab,
+                                uint16_t* cptr, uint16_t* cons, uint16_t* pptr, uint16_t* params) {
+    memset(cptr, 0, sizeof(uint16_t) * ((size_t)parts + 1));
+    memset(pptr, 0, sizeof(uint16_t) * ((size_t)parts + 1));
+    for (uint16_t c = 0; c < skt->constraints.cap; c++) if (cons_lab[c] != FF_INVALID_INDEX) cptr[cons_lab[c] + 1]++;
+    for (uint16_t p = 0; p < skt->params.cap; p++) if (param_lab[p] != FF_INVALID_INDEX) pptr[param_lab[p] + 1]++;
+    for (uint16_t k = 0; k < parts; k++) { cptr[k + 1] += cptr[k]; pptr[k + 1] += pptr[k]; }
+    for (uint16_t c = 0; c < skt->constraints.cap; c++) if (cons_lab[c] != FF_INVALID_INDEX) cons[cptr[cons_lab[c]]++] = c;
+    for (uint16_t p = 0; p < skt->params.cap; p++) if (param_lab[p] != FF_INVALID_INDEX) params[pptr[param_lab[p]]++] = p;
+    for (uint16_t k = parts; k > 0; k--) { cptr[k] = cptr[k - 1]; pptr[k] = pptr[k - 1]; }
+    cptr[0] = pptr[0] = 0;
+}
+
+// Combines the stats of systems solved side by side or one after another:
+// sums of sizes and costs, the most iterations, the first failure's result
+// (a paused one before any, since the solve is not over), the largest
+// system's backend choice.
+static void ff__CombineStats(ff_SolveStats* st, const ff_SolveStats* const* list, uint16_t n) {
+    memset(st, 0, sizeof(*st));
+    st->pattern_reused = true;
+    st->result = FF_SOLVE_CONVERGED;
+    if (!n) return;
+    const ff_SolveStats* big = list[0];
+    ff_float res = 0.0, step = 0.0;
+    for (uint16_t k = 0; k < n; k++) {
+        const ff_SolveStats* ps = list[k];
+        if ((uint32_t)ps->rows + ps->cols > (uint32_t)big->rows + big->cols) big = ps;
+        st->rows        += ps->rows;
+        st->cols        += ps->cols;
+        st->nnz         += ps->nnz;
+        st->dense_cost  += ps->dense_cost;
+        st->band_cost   += ps->band_cost;
+        st->lsqr_cost   += ps->lsqr_cost;
+        st->redundant   += ps->redundant;
+        st->conflicting += ps->conflicting;
+        st->closed_form += ps->closed_form;
+        st->differentiated += ps->differentiated;
+        st->pattern_reused = st->pattern_reused && ps->pattern_reused;
+        if (ps->iterations > st->iterations) st->iterations = ps->iterations;
+        if (st->result != FF_SOLVE_PAUSED && ps->result != FF_SOLVE_CONVERGED &&
+            (st->result == FF_SOLVE_CONVERGED || ps->result == FF_SOLVE_PAUSED)) {
+            st->result = ps->result;
+            st->rate   = ps->rate;
+        }
+        res  += ps->residual * ps->residual;
+        step += ps->step_norm * ps->step_norm;
+    }
+    st->density     = (st->rows && st->cols) ? (ff_float)st->nnz / ((ff_float)st->rows * st->cols) : 0.0;
+    st->normal_dim  = big->normal_dim;
+    st->normal_fill = big->normal_fill;
+    st->normal_band = big->normal_band;
+    st->method      = big->method;
+    st->reason      = big->reason;
+    st->backend     = big->backend;
+    if (st->result == FF_SOLVE_CONVERGED) st->rate = big->rate;
+    st->residual    = sqrt(res);
+    st->step_norm   = sqrt(step);
+}
+
+// The components' stats from their blocks, and the sketch's from its
+// components (see ffSketch_ComponentStats).
+static void ffSketch__GatherStats(ff_Sketch* skt) {
+    const ff_SolveStats** list = malloc(sizeof(ff_SolveStats*) * skt->part_count);
+    for (uint16_t k = 0; k < skt->comp_count; k++) {
+        const uint16_t first = skt->comp_ptr[k], n = skt->comp_ptr[k + 1] - first;
+        for (uint16_t b = 0; b < n; b++) list[b] = &skt->parts[first + b].stats;
+        ff__CombineStats(&skt->comp_stats[k], list, n);
+        skt->comp_stats[k].components = 1;
+        skt->comp_stats[k].blocks     = n;
+    }
+    for (uint16_t k = 0; k < skt->comp_count; k++) list[k] = &skt->comp_stats[k];
+    ff__CombineStats(&skt->stats, list, skt->comp_count);
+    skt->stats.components = skt->comp_count;
+    skt->stats.blocks     = skt->part_count;
+    free(list);
+}
+
+// Links the sketch as one system: every live parameter takes part, used or not.
+static void ffSketch__LinkWhole(ff_Sketch* skt, uint16_t comps) {
+    ffSketch__DropParts(skt, 0);
+    free(skt->comp_ptr);
+    free(skt->comp_stats);
+    free(skt->comp_dirty);
+    skt->comp_ptr   = NULL;
+    skt->comp_stats = NULL;
+    skt->comp_dirty = NULL;
+    skt->comp_count = 0;
+    for (uint16_t c = 0; c < skt->constraints.cap; c++) if (skt->cons_part[c] != FF_INVALID_INDEX) skt->cons_part[c] = 0;
+    for (uint16_t p = 0; p < skt->params.cap; p++) if (skt->param_part[p] != FF_INVALID_INDEX) skt->param_part[p] = 0;
+    uint16_t* cons   = malloc(sizeof(uint16_t) * (skt->constraints.alive_count + 1));
+    uint16_t* params = malloc(sizeof(uint16_t) * (skt->params.alive_count + 1));
+    uint16_t  nc = 0, np = 0;
+    for (uint16_t c = 0; c < skt->constraints.cap; c++) if (skt->constraints.slots[c].alive) cons[nc++] = c;
+    for (uint16_t p = 0; p < skt->params.cap; p++) if (skt->params.slots[p].alive) params[np++] = p;
+    ffSketch__Link(skt, cons, params);
+    free(cons);
+    free(params);
+    skt->stats.components = comps ? 1 : 0;
+    skt->stats.blocks     = comps ? 1 : 0;
+}
+
+// Links parts first..first+parts-1 from block labels 0..parts-1 (by slot):
+// each is a sketch of its own over the shared tables, restricted to its
+// slots, with the owner's slot -> column map. A part is relinked in place, so
+// an edit that leaves a block's pattern alone keeps its symbolic analysis.
+static void ffSketch__LinkParts(ff_Sketch* skt, uint16_t first, uint16_t parts, const uint16_t* cons_block, const uint16_t* param_block) {
+    uint16_t* cptr   = malloc(sizeof(uint16_t) * ((size_t)parts + 1));
+    uint16_t* pptr   = malloc(sizeof(uint16_t) * ((size_t)parts + 1));
+    uint16_t* cons   = malloc(sizeof(uint16_t) * (skt->constraints.alive_count + 1));
+    uint16_t* params = malloc(sizeof(uint16_t) * (skt->params.alive_count + 1));
+    ffSketch__PartSlots(skt, parts, cons_block, param_block, cptr, cons, pptr, params);
+    for (uint16_t k = 0; k < parts; k++) {
+        ff_Sketch* part = &skt->parts[first + k];
+        part->params      = skt->params;
+        part->entities    = skt->entities;
+        part->constraints = skt->constraints;
+        part->params.alive_count      = pptr[k + 1] - pptr[k];
+        part->constraints.alive_count = cptr[k + 1] - cptr[k];
+        part->config = skt->config;
+        part->owner  = skt;
+        ffSketch__Link(part, cons + cptr[k], params + pptr[k]);
+        part->stats.components = 1;
+        part->stats.blocks     = 1;
+        part->link_outdated = false;
+    }
+    free(cptr);
+    free(pptr);
+    free(cons);
+    free(params);
+}
+
+// Points a kept part at the owner's tables again after they grew (and moved).
+static void ffSketch__Rebase(ff_Sketch* part, const ff_Sketch* skt) {
+    for (uint16_t c = 0; c < part->params.alive_count; c++)
+        part->tmp_params[c] = &skt->params.slots[part->param_slot[c]].payload;
+    for (uint16_t r = 0; r < part->constraints.alive_count; r++)
+        part->tmp_contraints[r] = &skt->constraints.slots[part->cons_slot[r]].payload;
+    const uint16_t rows = part->constraints.alive_count, cols = part->params.alive_count;
+    part->params      = skt->params;
+    part->entities    = skt->entities;
+    part->constraints = skt->constraints;
+    part->params.alive_count      = cols;
+    part->constraints.alive_count = rows;
+}
+
+// Relinks only what the edits since the last relink touched: the
+// constraints of the marked components and the new ones are split into
+// components and blocks again, and only their parts are rebuilt. The parts of
+// every other component are kept, derivatives, analysis and factorization
+// included; component numbers close up behind the dropped ones. False if the
+// sketch has to be relinked as a whole: it was not split, the split options
+// changed, or it would now be a single system.
+static bool ffSketch__RelinkEdited(ff_Sketch* skt) {
+    if (!skt->part_count || !skt->comp_dirty || !skt->config.decompose || skt->config.triangular != skt->link_triangular) return false;
+    const uint16_t ccap = skt->constraints.cap, pcap = skt->params.cap;
+
+    //the constraints to split again; parameters of touched components lose
+    //their label until the split finds them
+    uint16_t* region = calloc((size_t)skt->constraints.alive_count + 1, sizeof(uint16_t));
+    uint16_t  n = 0;
+    for (uint16_t c = 0; c < ccap; c++) {
+        if (!skt->constraints.slots[c].alive) continue;
+        const uint16_t comp = skt->cons_part[c];
+        if (comp == FF_INVALID_INDEX || skt->comp_dirty[comp]) region[n++] = c;
+    }
+    for (uint16_t k = 0; k < skt->comp_count; k++) {
+        if (!skt->comp_dirty[k]) continue;
+        for (uint16_t b = skt->comp_ptr[k]; b < skt->comp_ptr[k + 1]; b++) {
+            const ff_Sketch* part = &skt->parts[b];
+            for (uint16_t c = 0; c < part->params.alive_count; c++) {
+                const uint16_t slot = part->param_slot[c];
+                if (skt->param_part[slot] == k) skt->param_part[slot] = FF_INVALID_INDEX;
+            }
+        }
+    }
+    ff_SlotPattern pat;
+    ffSketch__SlotPattern(skt, region, n, &pat);
+    free(region);
+    const uint16_t comps = ffSketch__FindComponents(skt, &pat, skt->cons_part, skt->param_part);
+
+    uint16_t* cons_block  = malloc(sizeof(uint16_t) * (ccap ? ccap : 1));
+    uint16_t* param_block = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    uint16_t* block_comp  = malloc(sizeof(uint16_t) * ((size_t)pat.rows + pcap + 1));
+    uint16_t  blocks = comps;
+    if (skt->config.triangular) {
+        blocks = ffSketch__FindBlocks(skt, &pat, comps, cons_block, param_block, block_comp);
+    } else {
+        for (uint16_t c = 0; c < ccap; c++) cons_block[c] = FF_INVALID_INDEX;
+        for (uint16_t p = 0; p < pcap; p++) param_block[p] = FF_INVALID_INDEX;
+        for (uint16_t r = 0; r < pat.rows; r++) cons_block[pat.row_slot[r]] = skt->cons_part[pat.row_slot[r]];
+        for (uint32_t k = 0; k < pat.rowptr[pat.rows]; k++) param_block[pat.col[k]] = skt->param_part[pat.col[k]];
+        for (uint16_t k = 0; k < comps; k++) block_comp[k] = k;
+    }
+
+    uint16_t kept_comps = 0, kept_parts = 0;
+    for (uint16_t k = 0; k < skt->comp_count; k++) {
+        if (skt->comp_dirty[k]) continue;
+        kept_comps++;
+        kept_parts += skt->comp_ptr[k + 1] - skt->comp_ptr[k];
+    }
+    const uint16_t total = kept_parts + blocks;
+    if (total <= 1) {
+        ffSlotPattern__Free(&pat);
+        free(cons_block); free(param_block); free(block_comp);
+        return false;
+    }
+
+    //owner's column map over the grown table, shared by every part
+    if (skt->parts[0].params.cap != pcap) {
+        skt->param_cols = realloc(skt->param_cols, sizeof(uint16_t) * (pcap ? pcap : 1));
+        for (uint16_t p = skt->parts[0].params.cap; p < pcap; p++) skt->param_cols[p] = FF_INVALID_INDEX;
+    }
+
+    //kept parts move up front in their old order, the touched ones go
+    ff_Sketch*     parts = calloc(total, sizeof(ff_Sketch));
+    uint16_t*      ptr   = malloc(sizeof(uint16_t) * ((size_t)kept_comps + comps + 1));
+    ff_SolveStats* st    = calloc((size_t)kept_comps + comps, sizeof(ff_SolveStats));
+    uint16_t       at = 0, kc = 0;
+    for (uint16_t k = 0; k < skt->comp_count; k++) {
+        if (skt->comp_dirty[k]) {
+            for (uint16_t b = skt->comp_ptr[k]; b < skt->comp_ptr[k + 1]; b++) {
+                ffSketch_FreeToBaseState(&skt->parts[b]);
+                ffSketch__DropSymbolic(&skt->parts[b]);
+            }
+            continue;
+        }
+        ptr[kc] = at;
+        st[kc]  = skt->comp_stats[k];
+        for (uint16_t b = skt->comp_ptr[k]; b < skt->comp_ptr[k + 1]; b++, at++) {
+            ff_Sketch* part = &parts[at];
+            *part = skt->parts[b];
+            if (part->params.slots != skt->params.slots || part->constraints.slots != skt->constraints.slots ||
+                part->params.cap != pcap || part->constraints.cap != ccap) ffSketch__Rebase(part, skt);
+            part->param_cols = skt->param_cols;
+            part->stats.differentiated = 0;
+            if (kc == k) continue;
+            for (uint16_t r = 0; r < part->constraints.alive_count; r++)
+                skt->cons_part[part->cons_slot[r]] = kc;
+            for (uint16_t c = 0; c < part->params.alive_count; c++)
+                skt->param_part[part->param_slot[c]] = kc;
+        }
+        kc++;
+    }
+
+    //the new components after them
+    for (uint16_t k = 0; k <= comps; k++) ptr[kc + k] = kept_parts;
+    for (uint16_t b = 0; b < blocks; b++) ptr[kc + block_comp[b] + 1]++;
+    for (uint16_t k = 0; k < comps; k++) ptr[kc + k + 1] += ptr[kc + k] - kept_parts;
+    for (uint16_t r = 0; r < pat.rows; r++) skt->cons_part[pat.row_slot[r]] = kc + block_comp[cons_block[pat.row_slot[r]]];
+    for (uint32_t k = 0; k < pat.rowptr[pat.rows]; k++)
+        skt->param_part[pat.col[k]] = kc + block_comp[param_block[pat.col[k]]];
+    ffSlotPattern__Free(&pat);
+
+    free(skt->parts);
+    free(skt->comp_ptr);
+    free(skt->comp_stats);
+    free(skt->comp_dirty);
+    skt->parts      = parts;
+    skt->part_count = total;
+    skt->comp_count = kc + comps;
+    skt->comp_ptr   = ptr;
+    skt->comp_stats = st;
+    skt->comp_dirty = calloc(skt->comp_count, sizeof(bool));
+
+    ffSketch__LinkParts(skt, kept_parts, blocks, cons_block, param_block);
+    free(cons_block); free(param_block); free(block_comp);
+
+    ffSketch__GatherStats(skt);
+    return true;
+}
+
+//todo add this to ff api?
+static void ffSketch_tryRelink(ff_Sketch* skt) {
+    if (!skt->link_outdated) return;
+    skt->active = NULL; //parts are about to move
+    skt->link_outdated = false;
+    ffSketch__DropResume(skt); //a paused solve's blocks are gone
+    free(skt->dof); //per-component counts follow the new numbering
+    skt->dof = NULL;
+    if (ffSketch__RelinkEdited(skt)) return;
+
+    const uint16_t ccap = skt->constraints.cap, pcap = skt->params.cap;
+    free(skt->cons_part);
+    free(skt->param_part);
+    skt->cons_part  = malloc(sizeof(uint16_t) * (ccap ? ccap : 1));
+    skt->param_part = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    for (uint16_t c = 0; c < ccap; c++) skt->cons_part[c] = FF_INVALID_INDEX;
+    for (uint16_t p = 0; p < pcap; p++) skt->param_part[p] = FF_INVALID_INDEX;
+    ff_SlotPattern pat;
+    ffSketch__SlotPattern(skt, NULL, 0, &pat);
+    const uint16_t comps = ffSketch__FindComponents(skt, &pat, skt->cons_part, skt->param_part);
+    if (!skt->config.decompose || (comps <= 1 && !skt->config.triangular)) {
+        ffSlotPattern__Free(&pat);
+        ffSketch__LinkWhole(skt, comps);
+        return;
+    }
+
+    uint16_t* cons_block  = skt->cons_part;
+    uint16_t* param_block = skt->param_part;
+    uint16_t* block_comp  = malloc(sizeof(uint16_t) * ((size_t)pat.rows + pcap + 1));
+    uint16_t  parts = comps;
+    if (skt->config.triangular) {
+        cons_block  = malloc(sizeof(uint16_t) * (ccap ? ccap : 1));
+        param_block = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+        parts = ffSketch__FindBlocks(skt, &pat, comps, cons_block, param_block, block_comp);
+    } else {
+        for (uint16_t k = 0; k < comps; k++) block_comp[k] = k;
+    }
+    ffSlotPattern__Free(&pat);
+    if (parts <= 1) {
+        if (cons_block != skt->cons_part) { free(cons_block); free(param_block); }
+        free(block_comp);
+        ffSketch__LinkWhole(skt, comps);
+        return;
+    }
+
+    ffSketch_FreeToBaseState(skt);
+    ffSketch__DropSymbolic(skt);
+    skt->param_cols = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    for (uint16_t p = 0; p < pcap; p++) skt->param_cols[p] = FF_INVALID_INDEX;
+    if (parts < skt->part_count) ffSketch__DropParts(skt, parts);
+    if (parts > skt->part_count) {
+        skt->parts = realloc(skt->parts, sizeof(ff_Sketch) * parts);
+        memset(skt->parts + skt->part_count, 0, sizeof(ff_Sketch) * (parts - skt->part_count));
+        skt->part_count = parts;
+    }
+    free(skt->comp_ptr);
+    free(skt->comp_stats);
+    free(skt->comp_dirty);
+    skt->comp_count = comps;
+    skt->comp_ptr   = calloc((size_t)comps + 1, sizeof(uint16_t));
+    skt->comp_stats = calloc(comps, sizeof(ff_SolveStats));
+    skt->comp_dirty = calloc(comps, sizeof(bool));
+    skt->link_triangular = skt->config.triangular;
+    for (uint16_t k = 0; k < parts; k++) skt->comp_ptr[block_comp[k] + 1]++;
+    for (uint16_t k = 0; k < comps; k++) skt->comp_ptr[k + 1] += skt->comp_ptr[k];
+
+    ffSketch__LinkParts(skt, 0, parts, cons_block, param_block);
+    if (cons_block != skt->cons_part) { free(cons_block); free(param_block); }
+    free(block_comp);
+
+    ffSketch__GatherStats(skt);
+}
+
+
+
+// -=-=-=-=- High level push/pop -=-=-=-=- //
+
+
+
+// -=-=-=-=- High level getters / equality -=-=-=-=- //
+
+
+//Params
+
+
+
+
+
+
+#pragma region SOLVING
+
+
+
+// Evaluates every constraint error; converged once the first `rows` (the
+// ones in the Newton system) are within tolerance.
+static inline bool ffSketch_calcError(ff_Sketch* skt, uint16_t rows, double tolerance) {
+    bool converged = true;
+
+    //a split sketch links its rows in its parts
+    for (uint16_t k = 0; k < skt->part_count; k++)
+        converged = ffSketch_calcError(&skt->parts[k], skt->parts[k].constraints.alive_count, tolerance) && converged;
+    if (skt->part_count) return converged;
+
+    for (uint16_t i = 0; i < skt->constraints.alive_count; i++) {
+        ff_Constraint* cons = skt->tmp_contraints[i];
+        cons->JMR.err = expr_evaluate(cons->def.eq, &skt->params);
+        if (i < rows && !(fabs(cons->JMR.err) <= tolerance)) converged = false; //NaN never converges
+        FF_LOG("Constraint %d error: %f\n", i, cons->JMR.err);
+    }
+
+    return converged;
+}
+
+// out = J * v + beta * out
+static inline void ffSketch__Jv(const ff_Sketch* skt, uint16_t rows, const ff_float* v, ff_float beta, ff_float* out) {
+    for (uint16_t r = 0; r < rows; r++) {
+        const ff_Constraint* cons = skt->tmp_contraints[r];
+        ff_float sum = 0.0;
+        for (uint16_t k = 0; k < cons->JMR.dervs_cnt; k++) {
+            sum += cons->JMR.dervs_y[k] * v[cons->JMR.dervs_col[k]];
+        }
+        out[r] = sum + beta * out[r];
+    }
+}
+
+// out = J^T * u (out is overwritten)
+static inline void ffSketch__JTv(const ff_Sketch* skt, uint16_t rows, uint16_t cols, const ff_float* u, ff_float* out) {
+    memset(out, 0, sizeof(ff_float) * cols);
+    for (uint16_t r = 0; r < rows; r++) {
+        const ff_Constraint* cons = skt->tmp_contraints[r];
+        const ff_float ur = u[r];
+        if (ur == 0.0) continue;
+        for (uint16_t k = 0; k < cons->JMR.dervs_cnt; k++) {
+            out[cons->JMR.dervs_col[k]] += cons->JMR.dervs_y[k] * ur;
+        }
+    }
+}
+
+static inline ff_float ff__norm2(const ff_float* v, uint32_t n) {
+    ff_float sum = 0.0;
+    for (uint32_t i = 0; i < n; i++) sum += v[i] * v[i];
+    return sqrt(sum);
+}
+
+static inline bool ffSketch__IsSquare(const ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    return rows == cols && skt->struct_rank == rows && skt->jac_map;
+}
+
+// Least-squares method: used directly for non-square systems and as the
+// fallback when a direct LU factorization breaks down. Unless config.linear
+// names one, it is chosen from the relink measurements in skt->stats.
+static enum ff_LinearMethod ffSketch__PickLeastSquares(const ff_Sketch* skt, const char** reason) {
+    const ff_SolveStats* st = &skt->stats;
+    if (skt->config.linear == FF_LINEAR_DENSE || skt->config.linear == FF_LINEAR_LSQR || skt->config.linear == FF_LINEAR_BANDED) {
+        *reason = "set by config.linear";
+        return skt->config.linear;
+    }
+    if (st->normal_dim <= FF_AUTO_TINY) {
+        *reason = "tiny normal matrix";
+        return FF_LINEAR_DENSE;
+    }
+    if (st->band_cost <= st->lsqr_cost && (st->band_cost < st->dense_cost || st->normal_dim > skt->config.dense_max_rows)) {
+        *reason = "banded cost estimate lowest";
+        return FF_LINEAR_BANDED;
+    }
+    if (st->normal_dim > skt->config.dense_max_rows) {
+        *reason = "normal matrix above dense_max_rows";
+        return FF_LINEAR_LSQR;
+    }
+    if (st->dense_cost <= st->lsqr_cost) {
+        *reason = "dense cost estimate below LSQR";
+        return FF_LINEAR_DENSE;
+    }
+    *reason = "LSQR cost estimate below dense";
+    return FF_LINEAR_LSQR;
+}
+
+static enum ff_LinearMethod ffSketch__PickLinear(const ff_Sketch* skt, uint16_t rows, uint16_t cols, const char** reason) {
+    if (skt->config.linear == FF_LINEAR_CUSTOM && skt->config.backend) {
+        *reason = "custom backend";
+        return FF_LINEAR_CUSTOM;
+    }
+    if (skt->config.linear == FF_LINEAR_SMALL) {
+        *reason = "set by config.linear";
+        return FF_LINEAR_SMALL;
+    }
+    if (skt->config.linear == FF_LINEAR_AUTO && skt->stats.normal_dim <= FF_SMALL_MAX) {
+        *reason = "small system, fixed-size kernels";
+        return FF_LINEAR_SMALL;
+    }
+    if (skt->config.linear == FF_LINEAR_AUTO || skt->config.linear == FF_LINEAR_LU) {
+        if (ffSketch__IsSquare(skt, rows, cols)) {
+            *reason = (skt->config.linear == FF_LINEAR_LU) ? "set by config.linear" : "square, structurally nonsingular";
+            return FF_LINEAR_LU;
+        }
+    }
+    return ffSketch__PickLeastSquares(skt, reason);
+}
+
+#pragma region Dense Kernels
+
+/* Block sizes for the dense normal-matrix kernels. NB is the Cholesky panel
+   width; SYRK_JB/SYRK_KB tile the product so a tile of rows stays in L2. */
+#define FF_DENSE_NB      64
+#define FF_DENSE_SYRK_JB 32
+#define FF_DENSE_SYRK_KB 256
+
+// out[0..3] = dot(a, b0..b3) over n elements
+static inline void ff__Dot1x4(const ff_float* a, const ff_float* b0, const ff_float* b1, const ff_float* b2, const ff_float* b3, uint32_t n, ff_float* out) {
+    uint32_t i = 0;
+    ff_float s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+#if FF_SIMD_AVX2
+    __m256d v0 = _mm256_setzero_pd(), v1 = _mm256_setzero_pd(), v2 = _mm256_setzero_pd(), v3 = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        __m256d va = _mm256_loadu_pd(a + i);
+        v0 = _mm256_fmadd_pd(va, _mm256_loadu_pd(b0 + i), v0);
+        v1 = _mm256_fmadd_pd(va, _mm256_loadu_pd(b1 + i), v1);
+        v2 = _mm256_fmadd_pd(va, _mm256_loadu_pd(b2 + i), v2);
+        v3 = _mm256_fmadd_pd(va, _mm256_loadu_pd(b3 + i), v3);
+    }
+    //horizontal sums of the four accumulators at once
+    __m256d h01 = _mm256_hadd_pd(v0, v1);
+    __m256d h23 = _mm256_hadd_pd(v2, v3);
+    __m256d sum = _mm256_add_pd(_mm256_permute2f128_pd(h01, h23, 0x20), _mm256_permute2f128_pd(h01, h23, 0x31));
+    double tmp[4];
+    _mm256_storeu_pd(tmp, sum);
+    s0 = tmp[0]; s1 = tmp[1]; s2 = tmp[2]; s3 = tmp[3];
+#endif
+    for (; i < n; i++) {
+        s0 += a[i] * b0[i];
+        s1 += a[i] * b1[i];
+        s2 += a[i] * b2[i];
+        s3 += a[i] * b3[i];
+    }
+    out[0] = s0; out[1] = s1; out[2] = s2; out[3] = s3;
+}
+
+static inline ff_float ff__Dot(const ff_float* a, const ff_float* b, uint32_t n) {
+    uint32_t i = 0;
+    ff_float s = 0.0;
+#if FF_SIMD_AVX2
+    __m256d v0 = _mm256_setzero_pd(), v1 = _mm256_setzero_pd();
+    for (; i + 8 <= n; i += 8) {
+        v0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i),     _mm256_loadu_pd(b + i),     v0);
+        v1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), v1);
+    }
+    double tmp[4];
+    _mm256_storeu_pd(tmp, _mm256_add_pd(v0, v1));
+    s = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+#endif
+    for (; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+// y -= a0*x0 + a1*x1 + a2*x2 + a3*x3 over n elements
+static inline void ff__Axpy4Sub(ff_float* y, const ff_float* x0, const ff_float* x1, const ff_float* x2, const ff_float* x3,
+                                ff_float a0, ff_float a1, ff_float a2, ff_float a3, uint32_t n) {
+    uint32_t i = 0;
+#if FF_SIMD_AVX2
+    const __m256d va0 = _mm256_set1_pd(a0), va1 = _mm256_set1_pd(a1), va2 = _mm256_set1_pd(a2), va3 = _mm256_set1_pd(a3);
+    for (; i + 4 <= n; i += 4) {
+        __m256d vy = _mm256_loadu_pd(y + i);
+        vy = _mm256_fnmadd_pd(va0, _mm256_loadu_pd(x0 + i), vy);
+        vy = _mm256_fnmadd_pd(va1, _mm256_loadu_pd(x1 + i), vy);
+        vy = _mm256_fnmadd_pd(va2, _mm256_loadu_pd(x2 + i), vy);
+        vy = _mm256_fnmadd_pd(va3, _mm256_loadu_pd(x3 + i), vy);
+        _mm256_storeu_pd(y + i, vy);
+    }
+#endif
+    for (; i < n; i++) y[i] -= a0 * x0[i] + a1 * x1[i] + a2 * x2[i] + a3 * x3[i];
+}
+
+static inline void ff__AxpySub(ff_float* y, const ff_float* x, ff_float a, uint32_t n) {
+    uint32_t i = 0;
+#if FF_SIMD_AVX2
+    const __m256d va = _mm256_set1_pd(a);
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(y + i, _mm256_fnmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+#endif
+    for (; i < n; i++) y[i] -= a * x[i];
+}
+
+// Lower triangle of C = X*X^T, with X m x k row-major (leading dimension k) and
+// C m x m column-major. Tiled over rows of X and over k.
+static void ff__SyrkLower(const ff_float* X, uint32_t m, uint32_t k, ff_float* C) {
+    for (uint32_t j = 0; j < m; j++) memset(C + (size_t)j * m + j, 0, sizeof(ff_float) * (m - j));
+
+    for (uint32_t k0 = 0; k0 < k; k0 += FF_DENSE_SYRK_KB) {
+        const uint32_t kl = (k - k0 < FF_DENSE_SYRK_KB) ? k - k0 : FF_DENSE_SYRK_KB;
+        for (uint32_t j0 = 0; j0 < m; j0 += FF_DENSE_SYRK_JB) {
+            const uint32_t j1 = (j0 + FF_DENSE_SYRK_JB < m) ? j0 + FF_DENSE_SYRK_JB : m;
+            for (uint32_t i = j0; i < m; i++) {
+                const ff_float* xi = X + (size_t)i * k + k0;
+                const uint32_t jend = (i + 1 < j1) ? i + 1 : j1;
+                uint32_t j = j0;
+                for (; j + 4 <= jend; j += 4) {
+                    ff_float d[4];
+                    ff__Dot1x4(xi, X + (size_t)j * k + k0, X + (size_t)(j + 1) * k + k0,
+                               X + (size_t)(j + 2) * k + k0, X + (size_t)(j + 3) * k + k0, kl, d);
+                    C[i + (size_t)j * m]       += d[0];
+                    C[i + (size_t)(j + 1) * m] += d[1];
+                    C[i + (size_t)(j + 2) * m] += d[2];
+                    C[i + (size_t)(j + 3) * m] += d[3];
+                }
+                for (; j < jend; j++) C[i + (size_t)j * m] += ff__Dot(xi, X + (size_t)j * k + k0, kl);
+            }
+        }
+    }
+}
+
+/* Single-precision twins of the kernels above, used by the mixed-precision
+   factorization: twice the lanes per AVX2 register and half the bytes per
+   cache line. */
+static inline float ff__DotF(const float* a, const float* b, uint32_t n) {
+    uint32_t i = 0;
+    float s = 0.0f;
+#if FF_SIMD_AVX2
+    __m256 v0 = _mm256_setzero_ps(), v1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        v0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),     _mm256_loadu_ps(b + i),     v0);
+        v1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), v1);
+    }
+    float tmp[8];
+    _mm256_storeu_ps(tmp, _mm256_add_ps(v0, v1));
+    s = ((tmp[0] + tmp[1]) + (tmp[2] + tmp[3])) + ((tmp[4] + tmp[5]) + (tmp[6] + tmp[7]));
+#endif
+    for (; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+static inline void ff__Axpy4SubF(float* y, const float* x0, const float* x1, const float* x2, const float* x3,
+                                 float a0, float a1, float a2, float a3, uint32_t n) {
+    uint32_t i = 0;
+#if FF_SIMD_AVX2
+    const __m256 va0 = _mm256_set1_ps(a0), va1 = _mm256_set1_ps(a1), va2 = _mm256_set1_ps(a2), va3 = _mm256_set1_ps(a3);
+    for (; i + 8 <= n; i += 8) {
+        __m256 vy = _mm256_loadu_ps(y + i);
+        vy = _mm256_fnmadd_ps(va0, _mm256_loadu_ps(x0 + i), vy);
+        vy = _mm256_fnmadd_ps(va1, _mm256_loadu_ps(x1 + i), vy);
+        vy = _mm256_fnmadd_ps(va2, _mm256_loadu_ps(x2 + i), vy);
+        vy = _mm256_fnmadd_ps(va3, _mm256_loadu_ps(x3 + i), vy);
+        _mm256_storeu_ps(y + i, vy);
+    }
+#endif
+    for (; i < n; i++) y[i] -= a0 * x0[i] + a1 * x1[i] + a2 * x2[i] + a3 * x3[i];
+}
+
+static inline void ff__AxpySubF(float* y, const float* x, float a, uint32_t n) {
+    uint32_t i = 0;
+#if FF_SIMD_AVX2
+    const __m256 va = _mm256_set1_ps(a);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_fnmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+#endif
+    for (; i < n; i++) y[i] -= a * x[i];
+}
+
+/* Blocked right-looking Cholesky of the lower triangle of the column-major,
+   symmetric positive semi-definite n x n matrix A (in place, A = L*L^T).
+   Pivots at or below `tiny` mark a dependent row/column: the column of L is
+   zeroed and skip[j] set, so the solve leaves that unknown at zero (the same
+   behaviour the Gaussian "small pivot" skip had). Returns the accepted pivot
+   count (numerical rank).
+   CholSolve solves L*L^T x = b with that factor; b is overwritten and may
+   alias x.
+   Instantiated for ff_float and, with the F kernels, for float. */
+#define FF_DEFINE_CHOLESKY(SUFFIX, T)                                                      \
+    static uint16_t ff__CholFactor##SUFFIX(T* A, uint16_t n, ff_float tiny, uint8_t* skip) { \
+        uint16_t rank = 0;                                                                 \
+                                                                                           \
+        for (uint32_t k0 = 0; k0 < n; k0 += FF_DENSE_NB) {                                 \
+            const uint32_t k1 = (k0 + FF_DENSE_NB < n) ? k0 + FF_DENSE_NB : n;             \
+                                                                                           \
+            /* panel: left-looking within the block */                                     \
+            for (uint32_t j = k0; j < k1; j++) {                                           \
+                T* cj = A + (size_t)j * n;                                                 \
+                for (uint32_t k = k0; k < j; k++) {                                        \
+                    const T a = A[j + (size_t)k * n];                                      \
+                    if (a != 0) ff__AxpySub##SUFFIX(cj + j, A + (size_t)k * n + j, a, n - j); \
+                }                                                                          \
+                const T d = cj[j];                                                         \
+                if (!(d > tiny)) {                                                         \
+                    FF_LOG("Small pivot element: %f at row %d\n", (double)d, j);           \
+                    memset(cj + j, 0, sizeof(T) * (n - j));                                \
+                    skip[j] = 1;                                                           \
+                    continue;                                                              \
+                }                                                                          \
+                skip[j] = 0;                                                               \
+                rank++;                                                                    \
+                const T s = (T)sqrt(d);                                                    \
+                const T inv = (T)1 / s;                                                    \
+                cj[j] = s;                                                                 \
+                for (uint32_t i = j + 1; i < n; i++) cj[i] *= inv;                         \
+            }                                                                              \
+                                                                                           \
+            /* last row the panel touches; normal matrices of sketches are mostly          \
+               banded, so the trailing update stops there instead of at n */               \
+            uint32_t hi = k1;                                                              \
+            for (uint32_t k = k0; k < k1; k++) {                                           \
+                const T* ck = A + (size_t)k * n;                                           \
+                uint32_t last = n;                                                         \
+                while (last > hi && ck[last - 1] == 0) last--;                             \
+                hi = last;                                                                 \
+            }                                                                              \
+                                                                                           \
+            /* trailing update (lower triangle only), four panel columns per pass */       \
+            for (uint32_t j = k1; j < hi; j++) {                                           \
+                T* cj = A + (size_t)j * n + j;                                             \
+                const uint32_t len = hi - j;                                               \
+                uint32_t k = k0;                                                           \
+                for (; k + 4 <= k1; k += 4) {                                              \
+                    if (A[j + (size_t)k * n] == 0 && A[j + (size_t)(k + 1) * n] == 0 &&    \
+                        A[j + (size_t)(k + 2) * n] == 0 && A[j + (size_t)(k + 3) * n] == 0) continue; \
+                    ff__Axpy4Sub##SUFFIX(cj,                                               \
+                        A + (size_t)k * n + j,       A + (size_t)(k + 1) * n + j,          \
+                        A + (size_t)(k + 2) * n + j, A + (size_t)(k + 3) * n + j,          \
+                        A[j + (size_t)k * n],       A[j + (size_t)(k + 1) * n],            \
+                        A[j + (size_t)(k + 2) * n], A[j + (size_t)(k + 3) * n], len);      \
+                }                                                                          \
+                for (; k < k1; k++) {                                                      \
+                    const T a = A[j + (size_t)k * n];                                      \
+                    if (a != 0) ff__AxpySub##SUFFIX(cj, A + (size_t)k * n + j, a, len);    \
+                }                                                                          \
+            }                                                                              \
+        }                                                                                  \
+        return rank;                                                                       \
+    }                                                                                      \
+                                                                                           \
+    static void ff__CholSolve##SUFFIX(const T* L, uint16_t n, const uint8_t* skip, T* b, T* x) { \
+        for (uint32_t j = 0; j < n; j++) {                                                 \
+            if (skip[j]) { b[j] = 0; continue; }                                           \
+            b[j] /= L[j + (size_t)j * n];                                                  \
+            ff__AxpySub##SUFFIX(b + j + 1, L + (size_t)j * n + j + 1, b[j], n - j - 1);    \
+        }                                                                                  \
+        for (int32_t j = n - 1; j >= 0; j--) {                                             \
+            if (skip[j]) { x[j] = 0; continue; }                                           \
+            const T* lj = L + (size_t)j * n;                                               \
+            x[j] = (b[j] - ff__Dot##SUFFIX(lj + j + 1, x + j + 1, n - j - 1)) / lj[j];     \
+        }                                                                                  \
+    }
+
+FF_DEFINE_CHOLESKY(, ff_float)
+FF_DEFINE_CHOLESKY(F, float)
+
+// r = b - A*x for the symmetric matrix whose lower triangle is stored in the
+// column-major n x n array A (the residual of the mixed-precision solve).
+static void ff__SymResidual(const ff_float* A, uint16_t n, const ff_float* b, const ff_float* x, ff_float* r) {
+    memcpy(r, b, sizeof(ff_float) * n);
+    for (uint32_t j = 0; j < n; j++) {
+        const ff_float* cj = A + (size_t)j * n;
+        r[j] -= cj[j] * x[j] + ff__Dot(cj + j + 1, x + j + 1, n - j - 1);
+        ff__AxpySub(r + j + 1, cj + j + 1, x[j], n - j - 1);
+    }
+}
+
+// Cholesky of a symmetric band matrix with half-bandwidth `band`, lower band
+// stored column-major with stride band + 1 (diagonal first). Right-looking:
+// column j updates only the `band` columns after it, O(n*band^2) in all.
+// Pivots at or below `tiny` are skipped as in ff__CholFactor. Returns the rank.
+static uint16_t ff__BandCholFactor(ff_float* A, uint16_t n, uint16_t band, ff_float tiny, uint8_t* skip) {
+    const size_t w = (size_t)band + 1;
+    uint16_t rank = 0;
+    for (uint32_t j = 0; j < n; j++) {
+        ff_float* cj = A + j * w;
+        const uint32_t m = (band < n - 1 - j) ? band : n - 1 - j;
+        if (!(cj[0] > tiny)) {
+            FF_LOG("Small pivot element: %f at row %d\n", cj[0], j);
+            memset(cj, 0, sizeof(ff_float) * (m + 1));
+            skip[j] = 1;
+            continue;
+        }
+        skip[j] = 0;
+        rank++;
+        const ff_float s = sqrt(cj[0]);
+        const ff_float inv = 1.0 / s;
+        cj[0] = s;
+        for (uint32_t i = 1; i <= m; i++) cj[i] *= inv;
+        for (uint32_t k = 1; k <= m; k++) {
+            if (cj[k] != 0.0) ff__AxpySub(A + (j + k) * w, cj + k, cj[k], m - k + 1);
+        }
+    }
+    return rank;
+}
+
+// Solves L*L^T x = b in place with the factor from ff__BandCholFactor.
+static void ff__BandCholSolve(const ff_float* L, uint16_t n, uint16_t band, const uint8_t* skip, ff_float* b) {
+    const size_t w = (size_t)band + 1;
+    for (uint32_t j = 0; j < n; j++) {
+        if (skip[j]) { b[j] = 0.0; continue; }
+        const uint32_t m = (band < n - 1 - j) ? band : n - 1 - j;
+        b[j] /= L[j * w];
+        ff__AxpySub(b + j + 1, L + j * w + 1, b[j], m);
+    }
+    for (int32_t j = n - 1; j >= 0; j--) {
+        if (skip[j]) { b[j] = 0.0; continue; }
+        const uint32_t m = (band < n - 1 - j) ? band : n - 1 - j;
+        const ff_float* lj = L + j * w;
+        b[j] = (b[j] - ff__Dot(lj + 1, b + j + 1, m)) / lj[0];
+    }
+}
+
+#pragma endregion
+
+#pragma region Small Kernels
+
+/* Fixed-size dense kernels for systems of up to FF_SMALL_MAX unknowns. Every
+   loop bound is a compile-time constant, so the compiler unrolls them and
+   keeps the matrix in registers/L1; matrices are column-major N x N in
+   ff_Sketch::small. Instantiated for each N in FF_SMALL_SIZES. */
+#define FF_SMALL_SIZES \
+    X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7)  X(8) \
+    X(9)  X(10) X(11) X(12) X(13) X(14) X(15) X(16)
+
+/* SmallChol: Cholesky of the lower triangle; pivots at or below `tiny` are
+   skipped as in ff__CholFactor. Returns the rank.
+   SmallLU: LU with partial pivoting; false if a pivot is below epsilon. */
+#define FF_DEFINE_SMALL(N)                                                                   \
+    static uint16_t ff__SmallChol##N(ff_float* A, ff_float tiny, uint8_t* skip) {            \
+        uint16_t rank = 0;                                                                   \
+        for (int j = 0; j < N; j++) {                                                        \
+            ff_float d = A[j + j * N];                                                       \
+            for (int k = 0; k < j; k++) d -= A[j + k * N] * A[j + k * N];                    \
+            if (!(d > tiny)) {                                                               \
+                for (int i = j; i < N; i++) A[i + j * N] = 0.0;                              \
+                skip[j] = 1;                                                                 \
+                continue;                                                                    \
+            }                                                                                \
+            skip[j] = 0;                                                                     \
+            rank++;                                                                          \
+            const ff_float s = sqrt(d);                                                      \
+            A[j + j * N] = s;                                                                \
+            for (int i = j + 1; i < N; i++) {                                                \
+                ff_float v = A[i + j * N];                                                   \
+                for (int k = 0; k < j; k++) v -= A[i + k * N] * A[j + k * N];                \
+                A[i + j * N] = v / s;                                                        \
+            }                                                                                \
+        }                                                                                    \
+        return rank;                                                                         \
+    }                                                                                        \
+                                                                                             \
+    static void ff__SmallCholSolve##N(const ff_float* L, const uint8_t* skip, ff_float* b) { \
+        for (int j = 0; j < N; j++) {                                                        \
+            if (skip[j]) { b[j] = 0.0; continue; }                                           \
+            b[j] /= L[j + j * N];                                                            \
+            for (int i = j + 1; i < N; i++) b[i] -= L[i + j * N] * b[j];                     \
+        }                                                                                    \
+        for (int j = N - 1; j >= 0; j--) {                                                   \
+            if (skip[j]) continue;                                                           \
+            ff_float v = b[j];                                                               \
+            for (int i = j + 1; i < N; i++) v -= L[i + j * N] * b[i];                        \
+            b[j] = v / L[j + j * N];                                                         \
+        }                                                                                    \
+    }                                                                                        \
+                                                                                             \
+    static bool ff__SmallLU##N(ff_float* A, uint8_t* piv, ff_float epsilon) {                \
+        for (int k = 0; k < N; k++) {                                                        \
+            int p = k;                                                                       \
+            for (int i = k + 1; i < N; i++) if (fabs(A[i + k * N]) > fabs(A[p + k * N])) p = i; \
+            if (fabs(A[p + k * N]) < epsilon) return false;                                  \
+            piv[k] = (uint8_t)p;                                                             \
+            if (p != k) {                                                                    \
+                for (int j = 0; j < N; j++) {                                                \
+                    ff_float t = A[k + j * N]; A[k + j * N] = A[p + j * N]; A[p + j * N] = t; \
+                }                                                                            \
+            }                                                                                \
+            const ff_float inv = 1.0 / A[k + k * N];                                         \
+            for (int i = k + 1; i < N; i++) A[i + k * N] *= inv;                             \
+            for (int j = k + 1; j < N; j++) {                                                \
+                const ff_float a = A[k + j * N];                                             \
+                for (int i = k + 1; i < N; i++) A[i + j * N] -= A[i + k * N] * a;            \
+            }                                                                                \
+        }                                                                                    \
+        return true;                                                                         \
+    }                                                                                        \
+                                                                                             \
+    static void ff__SmallLUSolve##N(const ff_float* LU, const uint8_t* piv, ff_float* b) {   \
+        /* the factorization swapped whole rows, L included: permute b first */            \
+        for (int k = 0; k < N; k++) {                                                        \
+            if (piv[k] != k) { ff_float t = b[k]; b[k] = b[piv[k]]; b[piv[k]] = t; }         \
+        }                                                                                    \
+        for (int k = 0; k < N; k++) {                                                        \
+            for (int i = k + 1; i < N; i++) b[i] -= LU[i + k * N] * b[k];                    \
+        }                                                                                    \
+        for (int k = N - 1; k >= 0; k--) {                                                   \
+            ff_float v = b[k];                                                               \
+            for (int j = k + 1; j < N; j++) v -= LU[k + j * N] * b[j];                       \
+            b[k] = v / LU[k + k * N];                                                        \
+        }                                                                                    \
+    }
+
+#define X(N) FF_DEFINE_SMALL(N)
+FF_SMALL_SIZES
+#undef X
+
+enum { FF_SMALL_LU, FF_SMALL_JTJ, FF_SMALL_JJT };
+
+typedef struct ff__SmallKernels {
+    uint16_t (*chol)(ff_float* A, ff_float tiny, uint8_t* skip);
+    void     (*chol_solve)(const ff_float* L, const uint8_t* skip, ff_float* b);
+    bool     (*lu)(ff_float* A, uint8_t* piv, ff_float epsilon);
+    void     (*lu_solve)(const ff_float* LU, const uint8_t* piv, ff_float* b);
+} ff__SmallKernels;
+
+static const ff__SmallKernels ff__small_kernels[FF_SMALL_MAX + 1] = {
+    { NULL, NULL, NULL, NULL },
+#define X(N) { ff__SmallChol##N, ff__SmallCholSolve##N, ff__SmallLU##N, ff__SmallLUSolve##N },
+    FF_SMALL_SIZES
+#undef X
+};
+
+#pragma endregion
+
+#pragma region Sparse LU
+
+static bool ffCsc__Reserve(ff_CscMatrix* m, uint32_t need) {
+    if (need <= m->cap) return true;
+    uint32_t cap = m->cap ? m->cap : 64;
+    while (cap < need) cap *= 2;
+    uint16_t* i = realloc(m->i, sizeof(uint16_t) * cap);
+    if (!i) return false;
+    m->i = i;
+    ff_float* x = realloc(m->x, sizeof(ff_float) * cap);
+    if (!x) return false;
+    m->x = x;
+    m->cap = cap;
+    return true;
+}
+
+static bool ffLU__Init(ff_SparseLU* lu, uint16_t n, uint32_t nnz) {
+    if (lu->L.n_cols == n && lu->pinv) return true;
+    ffLU__Free(lu);
+    lu->L.n_rows = lu->L.n_cols = n;
+    lu->U.n_rows = lu->U.n_cols = n;
+    lu->L.p  = malloc(sizeof(uint32_t) * ((size_t)n + 1));
+    lu->U.p  = malloc(sizeof(uint32_t) * ((size_t)n + 1));
+    lu->pinv = malloc(sizeof(uint16_t) * (n ? n : 1));
+    lu->x    = malloc(sizeof(ff_float) * (n ? n : 1));
+    lu->iw   = malloc(sizeof(int32_t) * 3 * ((size_t)n + 1));
+    lu->mark = calloc(n ? n : 1, sizeof(uint32_t));
+    lu->stamp = 0;
+    return ffCsc__Reserve(&lu->L, 2 * nnz + n) && ffCsc__Reserve(&lu->U, 2 * nnz + n);
+}
+
+// Nonzero pattern of L \ A(:,col): depth-first search through the columns of L
+// already computed, starting from the nonzeros of A(:,col). The reach set is
+// left in xi[top..n-1] in topological order. L row indices are still original
+// row numbers here; pinv maps them to L columns (or FF_INVALID_INDEX).
+static int32_t ffLU__Reach(ff_SparseLU* lu, const ff_CscMatrix* A, uint16_t col, int32_t* xi, int32_t* pstack) {
+    const uint16_t n = A->n_rows;
+    const ff_CscMatrix* L = &lu->L;
+    int32_t top = n;
+    const uint32_t stamp = ++lu->stamp;
+
+    for (uint32_t p = A->p[col]; p < A->p[col + 1]; p++) {
+        int32_t j = A->i[p];
+        if (lu->mark[j] == stamp) continue;
+
+        int32_t head = 0;
+        xi[0] = j;
+        while (head >= 0) {
+            j = xi[head];
+            int32_t jnew = (lu->pinv[j] == FF_INVALID_INDEX) ? -1 : lu->pinv[j];
+            if (lu->mark[j] != stamp) {
+                lu->mark[j] = stamp;
+                pstack[head] = (jnew < 0) ? 0 : (int32_t)L->p[jnew];
+            }
+            bool done = true;
+            int32_t p2 = (jnew < 0) ? 0 : (int32_t)L->p[jnew + 1];
+            for (int32_t q = pstack[head]; q < p2; q++) {
+                int32_t i = L->i[q];
+                if (lu->mark[i] == stamp) continue;
+                pstack[head] = q;
+                xi[++head] = i;
+                done = false;
+                break;
+            }
+            if (done) {
+                head--;
+                xi[--top] = j;
+            }
+        }
+    }
+    return top;
+}
+
+// Left-looking (Gilbert-Peierls) LU with threshold partial pivoting: for each
+// column solve the sparse triangular system against the finished part of L,
+// then pick the pivot, preferring the structurally matched row whenever it is
+// within `tol` of the largest candidate. Returns false if a column has no
+// pivot above `epsilon` (numerically singular).
+static bool ffLU__Factor(ff_SparseLU* lu, const ff_CscMatrix* A, const uint16_t* match_row, ff_float tol, ff_float epsilon) {
+    const uint16_t n = A->n_cols;
+    if (!ffLU__Init(lu, n, A->nnz)) return false;
+    lu->symbolic = false;
+
+    ff_CscMatrix* L = &lu->L;
+    ff_CscMatrix* U = &lu->U;
+    ff_float* x = lu->x;
+    int32_t*  xi = lu->iw;                    // 2n: DFS stack + reach set
+    int32_t*  pstack = lu->iw + 2 * (size_t)n; // n
+
+    for (uint16_t i = 0; i < n; i++) { lu->pinv[i] = FF_INVALID_INDEX; x[i] = 0.0; }
+    uint32_t lnz = 0, unz = 0;
+
+    for (uint16_t k = 0; k < n; k++) {
+        L->p[k] = lnz;
+        U->p[k] = unz;
+        if (!ffCsc__Reserve(L, lnz + n) || !ffCsc__Reserve(U, unz + n)) return false;
+
+        //x = L \ A(:,k)
+        int32_t top = ffLU__Reach(lu, A, k, xi, pstack);
+        for (uint32_t p = A->p[k]; p < A->p[k + 1]; p++) x[A->i[p]] = A->x[p];
+        for (int32_t px = top; px < n; px++) {
+            int32_t j = xi[px];
+            if (lu->pinv[j] == FF_INVALID_INDEX) continue;
+            uint16_t J = lu->pinv[j];
+            const ff_float xj = x[j];
+            for (uint32_t p = L->p[J] + 1; p < L->p[J + 1]; p++) x[L->i[p]] -= L->x[p] * xj;
+        }
+
+        //pivot search over rows not yet pivotal; pivotal rows go to U
+        int32_t  ipiv = -1;
+        ff_float a = -1.0;
+        for (int32_t px = top; px < n; px++) {
+            int32_t i = xi[px];
+            if (lu->pinv[i] == FF_INVALID_INDEX) {
+                if (fabs(x[i]) > a) { a = fabs(x[i]); ipiv = i; }
+            } else {
+                U->i[unz] = lu->pinv[i];
+                U->x[unz++] = x[i];
+            }
+        }
+        if (ipiv < 0 || a < epsilon) {
+            for (int32_t px = top; px < n; px++) x[xi[px]] = 0.0;
+            FF_LOG("LU: no pivot in column %d (%g)\n", k, a);
+            return false;
+        }
+        uint16_t pref = match_row ? match_row[k] : k;
+        if (pref != FF_INVALID_INDEX && lu->pinv[pref] == FF_INVALID_INDEX && fabs(x[pref]) >= a * tol) ipiv = pref;
+
+        const ff_float pivot = x[ipiv];
+        U->i[unz] = k;
+        U->x[unz++] = pivot;
+        lu->pinv[ipiv] = k;
+        L->i[lnz] = (uint16_t)ipiv;
+        L->x[lnz++] = 1.0;
+        for (int32_t px = top; px < n; px++) {
+            int32_t i = xi[px];
+            if (lu->pinv[i] == FF_INVALID_INDEX) {
+                L->i[lnz] = (uint16_t)i;
+                L->x[lnz++] = x[i] / pivot;
+            }
+            x[i] = 0.0;
+        }
+    }
+    L->p[n] = lnz;
+    U->p[n] = unz;
+    L->nnz = lnz;
+    U->nnz = unz;
+
+    //L row indices were original rows during factorization; renumber to pivot order
+    for (uint32_t p = 0; p < lnz; p++) L->i[p] = lu->pinv[L->i[p]];
+    lu->symbolic = true;
+    return true;
+}
+
+// Numeric refactorization for new values on the same pattern: reuses the pivot
+// order and the L/U patterns of the last ffLU__Factor, so there is no reach
+// and no pivot search. U columns were stored in the order the triangular solve
+// visits them, which is all the elimination needs. Fails, leaving a full
+// factorization to the caller, once a kept pivot falls below epsilon or below
+// `tol` times the largest entry it would divide.
+static bool ffLU__Refactor(ff_SparseLU* lu, const ff_CscMatrix* A, ff_float tol, ff_float epsilon) {
+    const uint16_t n = A->n_cols;
+    ff_CscMatrix* L = &lu->L;
+    ff_CscMatrix* U = &lu->U;
+    ff_float* x = lu->x; //indexed by pivot position here
+    memset(x, 0, sizeof(ff_float) * n);
+
+    for (uint16_t k = 0; k < n; k++) {
+        for (uint32_t p = A->p[k]; p < A->p[k + 1]; p++) x[lu->pinv[A->i[p]]] = A->x[p];
+
+        const uint32_t diag = U->p[k + 1] - 1;
+        for (uint32_t p = U->p[k]; p < diag; p++) {
+            const uint16_t J = U->i[p];
+            const ff_float xj = x[J];
+            U->x[p] = xj;
+            x[J] = 0.0;
+            for (uint32_t q = L->p[J] + 1; q < L->p[J + 1]; q++) x[L->i[q]] -= L->x[q] * xj;
+        }
+
+        const ff_float pivot = x[k];
+        ff_float amax = 0.0;
+        x[k] = 0.0;
+        for (uint32_t q = L->p[k] + 1; q < L->p[k + 1]; q++) if (fabs(x[L->i[q]]) > amax) amax = fabs(x[L->i[q]]);
+        if (fabs(pivot) < epsilon || fabs(pivot) < tol * amax) {
+            FF_LOG("LU refactor: pivot %g in column %d has degraded\n", pivot, k);
+            lu->symbolic = false;
+            return false;
+        }
+        U->x[diag] = pivot;
+        for (uint32_t q = L->p[k] + 1; q < L->p[k + 1]; q++) {
+            L->x[q] = x[L->i[q]] / pivot;
+            x[L->i[q]] = 0.0;
+        }
+    }
+    return true;
+}
+
+// Solve A*x = b with the factors; b and x may alias.
+static void ffLU__Solve(const ff_SparseLU* lu, const ff_float* b, ff_float* x) {
+    const ff_CscMatrix* L = &lu->L;
+    const ff_CscMatrix* U = &lu->U;
+    const uint16_t n = L->n_cols;
+    ff_float* y = lu->x;
+
+    for (uint16_t i = 0; i < n; i++) y[lu->pinv[i]] = b[i];
+    for (uint16_t j = 0; j < n; j++) {
+        const ff_float yj = y[j];
+        for (uint32_t p = L->p[j] + 1; p < L->p[j + 1]; p++) y[L->i[p]] -= L->x[p] * yj;
+    }
+    for (int32_t j = n - 1; j >= 0; j--) {
+        y[j] /= U->x[U->p[j + 1] - 1];
+        const ff_float yj = y[j];
+        for (uint32_t p = U->p[j]; p < U->p[j + 1] - 1; p++) y[U->i[p]] -= U->x[p] * yj;
+    }
+    memcpy(x, y, sizeof(ff_float) * n);
+}
+
+#pragma endregion
+
+static void ffSketch__EnsureNormal(ff_Sketch* skt, uint16_t n) {
+    if (skt->normal_dim == n) return;
+    free(skt->normal_mtr);
+    free(skt->normal_skip);
+    free(skt->normal_f);
+    skt->normal_mtr  = malloc(sizeof(ff_float) * n * n);
+    skt->normal_skip = malloc(n ? n : 1);
+    skt->normal_f    = NULL;
+    skt->normal_dim  = n;
+}
+
+// Jacobians this dense (nonzeros / (rows*cols)) are copied into a contiguous
+// buffer and multiplied with the SYRK kernel; sparser ones are cheaper to
+// accumulate straight from the sparse rows.
+#define FF_DENSE_SYRK_MIN_FILL 0.125
+
+static bool ffSketch__UseSyrk(const ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    size_t nnz = 0;
+    for (uint16_t r = 0; r < rows; r++) nnz += skt->tmp_contraints[r]->JMR.dervs_cnt;
+    return (ff_float)nnz >= FF_DENSE_SYRK_MIN_FILL * (ff_float)rows * (ff_float)cols;
+}
+
+// Copies J into dense_jac: row-major (rows x cols) or, with `transpose`,
+// column-major, which is J^T row-major.
+static ff_float* ffSketch__DenseJacobian(ff_Sketch* skt, uint16_t rows, uint16_t cols, bool transpose) {
+    const size_t need = (size_t)rows * cols;
+    if (skt->dense_jac_cap < need) {
+        free(skt->dense_jac);
+        skt->dense_jac = malloc(sizeof(ff_float) * need);
+        skt->dense_jac_cap = need;
+    }
+    ff_float* X = skt->dense_jac;
+    memset(X, 0, sizeof(ff_float) * need);
+    for (uint16_t r = 0; r < rows; r++) {
+        const ff_Constraint* cons = skt->tmp_contraints[r];
+        for (uint16_t k = 0; k < cons->JMR.dervs_cnt; k++) {
+            const uint16_t c = cons->JMR.dervs_col[k];
+            X[transpose ? (size_t)c * rows + r : (size_t)r * cols + c] = cons->JMR.dervs_y[k];
+        }
+    }
+    return X;
+}
+
+// Lower triangle of A = J^T*J (cols x cols).
+// Sparse: every row adds the lower half of the outer product of its few
+// nonzeros (columns are sorted ascending).
+static void ffSketch__BuildJTJ(ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    ff_float* A = skt->normal_mtr;
+    if (ffSketch__UseSyrk(skt, rows, cols)) {
+        ff__SyrkLower(ffSketch__DenseJacobian(skt, rows, cols, true), cols, rows, A);
+    } else {
+        for (uint32_t j = 0; j < cols; j++) memset(A + (size_t)j * cols + j, 0, sizeof(ff_float) * (cols - j));
+        for (int r = 0; r < rows; r++) {
+            const ff_Constraint* rc = skt->tmp_contraints[r];
+            for (uint16_t k = 0; k < rc->JMR.dervs_cnt; k++) {
+                const ff_float vk = rc->JMR.dervs_y[k];
+                if (vk == 0.0) continue;
+                ff_float* col = A + (size_t)rc->JMR.dervs_col[k] * cols;
+                for (uint16_t l = k; l < rc->JMR.dervs_cnt; l++) {
+                    col[rc->JMR.dervs_col[l]] += vk * rc->JMR.dervs_y[l];
+                }
+            }
+        }
+    }
+}
+
+// Lower triangle of A = J*J^T (rows x rows).
+// Sparse: scatter row c, then dot it with each row r >= c.
+static void ffSketch__BuildJJT(ff_Sketch* skt, uint16_t rows, uint16_t cols, ff_float* dense_row) {
+    ff_float* A = skt->normal_mtr;
+    if (ffSketch__UseSyrk(skt, rows, cols)) {
+        ff__SyrkLower(ffSketch__DenseJacobian(skt, rows, cols, false), rows, cols, A);
+    } else {
+        memset(dense_row, 0, sizeof(ff_float) * cols);
+        for (int c = 0; c < rows; c++) {
+            const ff_Constraint* cc = skt->tmp_contraints[c];
+            for (uint16_t k = 0; k < cc->JMR.dervs_cnt; k++) dense_row[cc->JMR.dervs_col[k]] = cc->JMR.dervs_y[k];
+
+            ff_float* col = A + (size_t)c * rows;
+            for (int r = c; r < rows; r++) {
+                const ff_Constraint* rc = skt->tmp_contraints[r];
+                double sum = 0.0;
+                for (uint16_t k = 0; k < rc->JMR.dervs_cnt; k++) {
+                    sum += rc->JMR.dervs_y[k] * dense_row[rc->JMR.dervs_col[k]];
+                }
+                col[r] = sum;
+            }
+
+            for (uint16_t k = 0; k < cc->JMR.dervs_cnt; k++) dense_row[cc->JMR.dervs_col[k]] = 0.0;
+        }
+    }
+}
+
+// Pivot threshold for the Cholesky of a normal matrix: the absolute epsilon,
+// raised for matrices whose diagonal is large so rounding noise on dependent
+// rows is not mistaken for a pivot.
+static ff_float ff__CholTiny(const ff_float* A, uint16_t n, ff_float epsilon) {
+    ff_float dmax = 0.0;
+    for (uint32_t j = 0; j < n; j++) if (A[j + (size_t)j * n] > dmax) dmax = A[j + (size_t)j * n];
+    return epsilon * (dmax > 1.0 ? dmax : 1.0);
+}
+
+// Mixed precision leaves pivots below this fraction of the largest diagonal
+// entry to the double factorization: a float factor that close to singular is
+// too inaccurate for refinement to recover the step.
+#define FF_MIXED_PIVOT_REL 1e-6
+
+// Factors the n x n normal matrix held in normal_mtr. In mixed precision its
+// lower triangle is copied to float and factored there, leaving normal_mtr
+// intact for the refinement residual; a float factorization that drops a pivot
+// is redone in double, whose rank is the one that counts, and the rest of the
+// solve stays in double. Returns the numerical rank.
+static uint16_t ffSketch__FactorNormal(ff_Sketch* skt, uint16_t n, ff_float epsilon) {
+    const ff_float* A = skt->normal_mtr;
+    skt->normal_tiny   = ff__CholTiny(A, n, epsilon);
+    skt->normal_single = false;
+    if (skt->solve_state.mixed) {
+        if (!skt->normal_f) skt->normal_f = malloc(sizeof(float) * ((size_t)n * n + n));
+        float* F = skt->normal_f;
+        ff_float dmax = 0.0;
+        for (uint32_t j = 0; j < n; j++) {
+            for (uint32_t i = j; i < n; i++) F[i + (size_t)j * n] = (float)A[i + (size_t)j * n];
+            if (A[j + (size_t)j * n] > dmax) dmax = A[j + (size_t)j * n];
+        }
+        const ff_float tiny_f = FF_MIXED_PIVOT_REL * dmax > skt->normal_tiny ? FF_MIXED_PIVOT_REL * dmax : skt->normal_tiny;
+        if (ff__CholFactorF(F, n, tiny_f, skt->normal_skip) == n) {
+            skt->normal_single = true;
+            return n;
+        }
+        FF_LOG("Single-precision factor lost a pivot, refactoring in double\n");
+        skt->solve_state.mixed = false;
+    }
+    return ff__CholFactor(skt->normal_mtr, n, skt->normal_tiny, skt->normal_skip);
+}
+
+// x = A^-1 b with the factor from ffSketch__FactorNormal; b is overwritten and
+// r is scratch for n values. A single-precision factor is refined against the
+// ff_float matrix, x += (L*L^T)^-1 (b - A*x), until the correction drops below
+// refine_tol relative to x. If the corrections stop halving first, A is
+// refactored in double and solved directly, as are later solves.
+static void ffSketch__SolveNormal(ff_Sketch* skt, uint16_t n, ff_float* b, ff_float* x, ff_float* r) {
+    if (skt->normal_single) {
+        float* d = skt->normal_f + (size_t)n * n;
+        ff_float dprev = 0.0;
+        memset(x, 0, sizeof(ff_float) * n);
+        memcpy(r, b, sizeof(ff_float) * n);
+        for (uint32_t it = 0; it <= skt->config.refine_max_iters; it++) {
+            for (uint16_t i = 0; i < n; i++) d[i] = (float)r[i];
+            ff__CholSolveF(skt->normal_f, n, skt->normal_skip, d, d);
+            ff_float dn = 0.0, xn = 0.0;
+            for (uint16_t i = 0; i < n; i++) {
+                x[i] += d[i];
+                if (fabs(d[i]) > dn) dn = fabs(d[i]);
+                if (fabs(x[i]) > xn) xn = fabs(x[i]);
+            }
+            if (dn <= skt->config.refine_tol * xn) {
+                FF_LOG("Mixed precision: %u refinement sweeps\n", it);
+                return;
+            }
+            if (it > 0 && !(dn <= 0.5 * dprev)) break;
+            dprev = dn;
+            ff__SymResidual(skt->normal_mtr, n, b, x, r);
+        }
+        FF_LOG("Mixed precision refinement stalled, refactoring in double\n");
+        ff__CholFactor(skt->normal_mtr, n, skt->normal_tiny, skt->normal_skip);
+        skt->normal_single = false;
+        skt->solve_state.mixed = false;
+    }
+    ff__CholSolve(skt->normal_mtr, n, skt->normal_skip, b, x);
+}
+
+// Matrix-free Newton step: LSQR on J*dx = b, started from zero so the result is
+// the minimum-norm step in the preconditioned variables. Column scaling changes
+// that norm, so it is skipped when J has more columns than rows: the step of an
+// under-constrained sketch is then the same as the direct backends'. Stops once
+// the residual drops below eta*||b|| or, for redundant/inconsistent systems,
+// once the normal-equation residual vanishes relative to ||A||*||r||.
+// Returns the number of LSQR iterations.
+static uint32_t ffSketch__LSQRStep(ff_Sketch* skt, uint16_t rows, uint16_t cols, const ff_float* b, ff_float eta, ff_float* dx, ff_float* work) {
+    ff_float* u = work;           // rows
+    ff_float* v = u + rows;       // cols
+    ff_float* w = v + cols;       // cols
+    ff_float* d = w + cols;       // cols, right preconditioner
+    ff_float* t = d + cols;       // cols
+
+    uint32_t max_it = skt->config.krylov_max_iters ? skt->config.krylov_max_iters : (uint32_t)rows + cols;
+
+    const bool jacobi = skt->config.precond == FF_PRECOND_JACOBI && cols <= rows;
+    for (uint16_t c = 0; c < cols; c++) d[c] = jacobi ? 0.0 : 1.0;
+    if (jacobi) {
+        for (uint16_t r = 0; r < rows; r++) {
+            const ff_Constraint* cons = skt->tmp_contraints[r];
+            for (uint16_t k = 0; k < cons->JMR.dervs_cnt; k++) {
+                d[cons->JMR.dervs_col[k]] += cons->JMR.dervs_y[k] * cons->JMR.dervs_y[k];
+            }
+        }
+        for (uint16_t c = 0; c < cols; c++) d[c] = (d[c] > 0.0) ? 1.0 / sqrt(d[c]) : 1.0;
+    }
+
+    memset(dx, 0, sizeof(ff_float) * cols);
+
+    memcpy(u, b, sizeof(ff_float) * rows);
+    ff_float beta = ff__norm2(u, rows);
+    if (beta == 0.0) return 0;
+    const ff_float beta0 = beta;
+    for (uint16_t r = 0; r < rows; r++) u[r] /= beta;
+
+    ffSketch__JTv(skt, rows, cols, u, t);
+    for (uint16_t c = 0; c < cols; c++) v[c] = d[c] * t[c];
+    ff_float alpha = ff__norm2(v, cols);
+    if (alpha == 0.0) return 0;
+    for (uint16_t c = 0; c < cols; c++) { v[c] /= alpha; w[c] = v[c]; }
+
+    ff_float phibar = beta;
+    ff_float rhobar = alpha;
+    ff_float anorm2 = alpha * alpha;
+
+    uint32_t it = 0;
+    while (it < max_it) {
+        it++;
+
+        // u = A*v - alpha*u
+        for (uint16_t c = 0; c < cols; c++) t[c] = d[c] * v[c];
+        ffSketch__Jv(skt, rows, t, -alpha, u);
+        beta = ff__norm2(u, rows);
+        if (beta > 0.0) for (uint16_t r = 0; r < rows; r++) u[r] /= beta;
+
+        // v = A^T*u - beta*v
+        ffSketch__JTv(skt, rows, cols, u, t);
+        for (uint16_t c = 0; c < cols; c++) v[c] = d[c] * t[c] - beta * v[c];
+        alpha = ff__norm2(v, cols);
+        if (alpha > 0.0) for (uint16_t c = 0; c < cols; c++) v[c] /= alpha;
+
+        anorm2 += alpha * alpha + beta * beta;
+
+        const ff_float rho   = sqrt(rhobar * rhobar + beta * beta);
+        const ff_float cs    = rhobar / rho;
+        const ff_float sn    = beta / rho;
+        const ff_float theta = sn * alpha;
+        const ff_float phi   = cs * phibar;
+        rhobar = -cs * alpha;
+        phibar =  sn * phibar;
+
+        const ff_float t1 = phi / rho;
+        const ff_float t2 = theta / rho;
+        for (uint16_t c = 0; c < cols; c++) {
+            dx[c] += t1 * w[c];
+            w[c]   = v[c] - t2 * w[c];
+        }
+
+        if (phibar <= eta * beta0) break;
+        if (alpha * fabs(cs) <= 1e-10 * sqrt(anorm2)) break;
+        if (alpha == 0.0 || beta == 0.0) break;
+    }
+
+    for (uint16_t c = 0; c < cols; c++) dx[c] *= d[c];
+
+    return it;
+}
+
+#pragma region Backends
+
+// Built-in backends keep their state in the sketch (user is the ff_Sketch) and
+// work in skt->scratch after the step vector, as laid out by ffSketch_Solve.
+static inline ff_float* ffSketch__Work(const ff_Sketch* skt, uint16_t cols) {
+    return skt->scratch + cols;
+}
+
+// Built-in backends are handed the sketch that owns them. A split sketch
+// routes them to the part it is working on, whose factors and scratch they use.
+static inline ff_Sketch* ff__BackendSketch(void* user) {
+    ff_Sketch* skt = user;
+    return skt->active ? skt->active : skt;
+}
+
+static bool ff__LUAnalyze(void* user, const ff_JacobianView* J) {
+    return ffSketch__IsSquare(ff__BackendSketch(user), J->rows, J->cols);
+}
+
+// A refactorization keeps pivots down to this fraction of their column,
+// looser than the 0.1 of the pivot search so a near-tie does not force a
+// full factorization on every Newton step.
+#define FF_LU_REFACTOR_TOL 0.01
+
+static bool ff__LUFactor(void* user, const ff_JacobianView* J, uint16_t* rank) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    //refresh CSC values from the packed rows
+    for (uint32_t e = 0; e < J->nnz; e++) skt->jac_csc.x[skt->jac_map[e]] = J->val[e];
+    //same pattern as the last factorization: values only, unless a pivot has degraded
+    if (skt->lu.symbolic && ffLU__Refactor(&skt->lu, &skt->jac_csc, FF_LU_REFACTOR_TOL, skt->solve_state.epsilon)) {
+        *rank = J->cols;
+        return true;
+    }
+    if (!ffLU__Factor(&skt->lu, &skt->jac_csc, skt->match_row, 0.1, skt->solve_state.epsilon)) {
+        *rank = 0;
+        return false;
+    }
+    FF_LOG("LU: nnz(L) %u, nnz(U) %u\n", skt->lu.L.nnz, skt->lu.U.nnz);
+    *rank = J->cols;
+    return true;
+}
+
+static void ff__LUSolve(void* user, const ff_JacobianView* J, const ff_float* b, ff_float tol, ff_float* dx) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    (void)tol;
+    memcpy(dx, b, sizeof(ff_float) * J->rows);
+    ffLU__Solve(&skt->lu, dx, dx);
+}
+
+// Builds and factors the normal matrix in solve_state.form. A rank-deficient
+// J^T*J switches the form to J*J^T for the rest of the solve when the form is
+// picked automatically.
+static bool ff__DenseFactor(void* user, const ff_JacobianView* J, uint16_t* rank) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    const uint16_t rows = J->rows, cols = J->cols;
+    const ff_float epsilon = skt->solve_state.epsilon;
+
+    if (skt->solve_state.form == FF_NORMAL_JTJ) {
+        ffSketch__EnsureNormal(skt, cols);
+        ffSketch__BuildJTJ(skt, rows, cols);
+        *rank = ffSketch__FactorNormal(skt, cols, epsilon);
+        FF_LOG("Normal matrix J^T*J %dx%d, rank %d\n", cols, cols, *rank);
+        if (*rank < cols && skt->config.normal_form == FF_NORMAL_AUTO) {
+            //redundant rows and free parameters at once: J^T*J is singular too,
+            //so take the minimum-norm step for the rest of this solve
+            skt->solve_state.form = FF_NORMAL_JJT;
+        }
+    }
+    if (skt->solve_state.form == FF_NORMAL_JJT) {
+        ffSketch__EnsureNormal(skt, rows);
+        ffSketch__BuildJJT(skt, rows, cols, ffSketch__Work(skt, cols));
+        *rank = ffSketch__FactorNormal(skt, rows, epsilon);
+        FF_LOG("Normal matrix J*J^T %dx%d, rank %d\n", rows, rows, *rank);
+    }
+    return true;
+}
+
+static void ff__DenseSolve(void* user, const ff_JacobianView* J, const ff_float* b, ff_float tol, ff_float* dx) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    const uint16_t rows = J->rows, cols = J->cols;
+    const uint16_t dim_max = rows > cols ? rows : cols;
+    ff_float* work = ffSketch__Work(skt, cols);
+    ff_float* rhs  = work + dim_max;
+    (void)tol;
+
+    if (skt->solve_state.form == FF_NORMAL_JTJ) {
+        ffSketch__JTv(skt, rows, cols, b, rhs);
+        ffSketch__SolveNormal(skt, cols, rhs, dx, work);
+    } else {
+        memcpy(rhs, b, sizeof(ff_float) * rows);
+        ffSketch__SolveNormal(skt, rows, rhs, skt->itrm_sol, work);
+        ffSketch__JTv(skt, rows, cols, skt->itrm_sol, dx);
+    }
+}
+
+// Matrix-free: nothing to factor, only the structural rank is known.
+static bool ff__LSQRFactor(void* user, const ff_JacobianView* J, uint16_t* rank) {
+    (void)user;
+    *rank = J->struct_rank;
+    return true;
+}
+
+static void ff__LSQRSolve(void* user, const ff_JacobianView* J, const ff_float* b, ff_float tol, ff_float* dx) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    uint32_t its = ffSketch__LSQRStep(skt, J->rows, J->cols, b, tol, dx, ffSketch__Work(skt, J->cols));
+    FF_LOG("LSQR: %u iterations, eta %g\n", its, tol);
+    (void)its;
+}
+
+// out = J^T * u over a backend's view of J (out is overwritten)
+static void ff__ViewJTv(const ff_JacobianView* J, const ff_float* u, ff_float* out) {
+    memset(out, 0, sizeof(ff_float) * J->cols);
+    for (uint16_t r = 0; r < J->rows; r++) {
+        if (u[r] == 0.0) continue;
+        for (uint32_t e = J->row_ptr[r]; e < J->row_ptr[r + 1]; e++) out[J->col[e]] += J->val[e] * u[r];
+    }
+}
+
+// Band-stored normal matrix in solve_state.form, with the bandwidth relink
+// measured for that form. Same pivoting and rank-deficient J^T*J switch as
+// ff__DenseFactor, but memory and work follow the band, so the relink
+// ordering decides what this costs.
+static bool ff__BandFactor(void* user, const ff_JacobianView* J, uint16_t* rank) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    ff_BandFactor* bf = &skt->band;
+    const bool jtj = skt->solve_state.form == FF_NORMAL_JTJ;
+    const uint16_t n = jtj ? J->cols : J->rows;
+    const uint16_t band = jtj ? bf->band_jtj : bf->band_jjt;
+    const size_t w = (size_t)band + 1;
+
+    if (bf->cap < (size_t)n * w) {
+        free(bf->a);
+        bf->cap = (size_t)n * w;
+        bf->a = malloc(sizeof(ff_float) * bf->cap);
+    }
+    if (bf->skip_cap < n) {
+        free(bf->skip);
+        bf->skip_cap = n;
+        bf->skip = malloc(n);
+    }
+    bf->n = n;
+    bf->band = band;
+
+    ff_float* A = bf->a;
+    memset(A, 0, sizeof(ff_float) * n * w);
+    if (jtj) {
+        //lower half of each row's outer product; columns are sorted and within the band
+        for (uint16_t r = 0; r < J->rows; r++) {
+            for (uint32_t k = J->row_ptr[r]; k < J->row_ptr[r + 1]; k++) {
+                ff_float* col = A + J->col[k] * w - J->col[k];
+                for (uint32_t l = k; l < J->row_ptr[r + 1]; l++) col[J->col[l]] += J->val[k] * J->val[l];
+            }
+        }
+    } else {
+        //scatter row c, then dot it with the rows of its band
+        ff_float* dense_row = ffSketch__Work(skt, J->cols);
+        memset(dense_row, 0, sizeof(ff_float) * J->cols);
+        for (uint16_t c = 0; c < n; c++) {
+            for (uint32_t e = J->row_ptr[c]; e < J->row_ptr[c + 1]; e++) dense_row[J->col[e]] = J->val[e];
+            const uint16_t last = (band < n - 1 - c) ? c + band : n - 1;
+            for (uint16_t r = c; r <= last; r++) {
+                ff_float sum = 0.0;
+                for (uint32_t e = J->row_ptr[r]; e < J->row_ptr[r + 1]; e++) sum += J->val[e] * dense_row[J->col[e]];
+                A[(r - c) + c * w] = sum;
+            }
+            for (uint32_t e = J->row_ptr[c]; e < J->row_ptr[c + 1]; e++) dense_row[J->col[e]] = 0.0;
+        }
+    }
+
+    ff_float dmax = 0.0;
+    for (uint16_t j = 0; j < n; j++) if (A[j * w] > dmax) dmax = A[j * w];
+    const ff_float tiny = skt->solve_state.epsilon * (dmax > 1.0 ? dmax : 1.0);
+    *rank = ff__BandCholFactor(A, n, band, tiny, bf->skip);
+    FF_LOG("Banded normal matrix %dx%d, half-bandwidth %d, rank %d\n", n, n, band, *rank);
+    if (jtj && *rank < n && skt->config.normal_form == FF_NORMAL_AUTO) {
+        skt->solve_state.form = FF_NORMAL_JJT;
+        return ff__BandFactor(user, J, rank);
+    }
+    return true;
+}
+
+static void ff__BandSolve(void* user, const ff_JacobianView* J, const ff_float* b, ff_float tol, ff_float* dx) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    const ff_BandFactor* bf = &skt->band;
+    (void)tol;
+
+    if (skt->solve_state.form == FF_NORMAL_JTJ) {
+        ff__ViewJTv(J, b, dx);
+        ff__BandCholSolve(bf->a, bf->n, bf->band, bf->skip, dx);
+    } else {
+        ff_float* y = ffSketch__Work(skt, J->cols);
+        memcpy(y, b, sizeof(ff_float) * J->rows);
+        ff__BandCholSolve(bf->a, bf->n, bf->band, bf->skip, y);
+        ff__ViewJTv(J, y, dx);
+    }
+}
 
-            cons->JMR.dervs = malloc(sizeof(ff_Expr*) * par_cnt);
-            cons->JMR.dervs_y = malloc(sizeof(double) * par_cnt);
+// Fixed-size kernels: a square, structurally nonsingular J is LU-factored as
+// is, anything else (or a square J found numerically singular) through its
+// normal matrix in solve_state.form. Factors live in skt->small; the solve
+// needs no scratch beyond a stack vector of FF_SMALL_MAX.
+static inline uint16_t ff__SmallDim(const ff_Sketch* skt, const ff_JacobianView* J) {
+    return skt->solve_state.form == FF_NORMAL_JTJ ? J->cols : J->rows;
+}
+
+static bool ff__SmallAnalyze(void* user, const ff_JacobianView* J) {
+    return ff__SmallDim(ff__BackendSketch(user), J) <= FF_SMALL_MAX;
+}
+
+static bool ff__SmallFactor(void* user, const ff_JacobianView* J, uint16_t* rank) {
+    ff_Sketch* skt = ff__BackendSketch(user);
+    ff_SmallFactor* sf = &skt->small;
+    ff_float* A = sf->a;
+
+    if (J->rows == J->cols && J->struct_rank == J->rows && J->rows <= FF_SMALL_MAX) {
+        const uint16_t n = J->rows;
+        memset(A, 0, sizeof(ff_float) * n * n);
+        for (uint16_t r = 0; r < n; r++) {
+            for (uint32_t e = J->row_ptr[r]; e < J->row_ptr[r + 1]; e++) A[r + J->col[e] * n] = J->val[e];
+        }
+        if (ff__small_kernels[n].lu(A, sf->piv, skt->solve_state.epsilon)) {
+            sf->n    = (uint8_t)n;
+            sf->kind = FF_SMALL_LU;
+            *rank    = n;
+            return true;
+        }
+        FF_LOG("Small LU: numerically singular, normal matrix instead\n");
+    }
+
+    const uint16_t n = ff__SmallDim(skt, J);
+    if (n > FF_SMALL_MAX) return false;
+    memset(A, 0, sizeof(ff_float) * n * n);
+    if (skt->solve_state.form == FF_NORMAL_JTJ) {
+        //lower half of each row's outer product (columns are sorted ascending)
+        for (uint16_t r = 0; r < J->rows; r++) {
+            for (uint32_t k = J->row_ptr[r]; k < J->row_ptr[r + 1]; k++) {
+                ff_float* col = A + J->col[k] * n;
+                for (uint32_t l = k; l < J->row_ptr[r + 1]; l++) col[J->col[l]] += J->val[k] * J->val[l];
+            }
+        }
+        sf->kind = FF_SMALL_JTJ;
+    } else {
+        //row dot products, merging the sorted column lists
+        for (uint16_t c = 0; c < n; c++) {
+            for (uint16_t r = c; r < n; r++) {
+                uint32_t p = J->row_ptr[c], q = J->row_ptr[r];
+                ff_float sum = 0.0;
+                while (p < J->row_ptr[c + 1] && q < J->row_ptr[r + 1]) {
+                    if      (J->col[p] < J->col[q]) p++;
+                    else if (J->col[p] > J->col[q]) q++;
+                    else sum += J->val[p++] * J->val[q++];
+                }
+                A[r + c * n] = sum;
+            }
+        }
+        sf->kind = FF_SMALL_JJT;
+    }
+    sf->n = (uint8_t)n;
+    *rank = ff__small_kernels[n].chol(A, ff__CholTiny(A, n, skt->solve_state.epsilon), sf->piv);
+    FF_LOG("Small normal matrix %dx%d, rank %d\n", n, n, *rank);
+    if (sf->kind == FF_SMALL_JTJ && *rank < n && skt->config.normal_form == FF_NORMAL_AUTO) {
+        //as in ff__DenseFactor; J*J^T may be too big for these kernels, in
+        //which case the fallback takes over
+        skt->solve_state.form = FF_NORMAL_JJT;
+        return ff__SmallFactor(user, J, rank);
+    }
+    return true;
+}
+
+static void ff__SmallSolve(void* user, const ff_JacobianView* J, const ff_float* b, ff_float tol, ff_float* dx) {
+    const ff_SmallFactor* sf = &ff__BackendSketch(user)->small;
+    const ff__SmallKernels* k = &ff__small_kernels[sf->n];
+    ff_float t[FF_SMALL_MAX];
+    (void)tol;
+
+    if (sf->kind == FF_SMALL_LU) {
+        memcpy(dx, b, sizeof(ff_float) * J->rows);
+        k->lu_solve(sf->a, sf->piv, dx);
+    } else if (sf->kind == FF_SMALL_JTJ) {
+        ff__ViewJTv(J, b, t);
+        k->chol_solve(sf->a, sf->piv, t);
+        memcpy(dx, t, sizeof(ff_float) * J->cols);
+    } else {
+        memcpy(t, b, sizeof(ff_float) * J->rows);
+        k->chol_solve(sf->a, sf->piv, t);
+        ff__ViewJTv(J, t, dx);
+    }
+}
+
+ff_LinearBackend ffSketch_BuiltinBackend(ff_Sketch* skt, enum ff_LinearMethod method) {
+    ff_LinearBackend b;
+    b.user = skt;
+    switch (method) {
+    case FF_LINEAR_LU:
+        b.name = "lu";    b.analyze = ff__LUAnalyze;    b.factor = ff__LUFactor;    b.solve = ff__LUSolve;
+        break;
+    case FF_LINEAR_LSQR:
+        b.name = "lsqr";  b.analyze = NULL;             b.factor = ff__LSQRFactor;  b.solve = ff__LSQRSolve;
+        break;
+    case FF_LINEAR_SMALL:
+        b.name = "small"; b.analyze = ff__SmallAnalyze; b.factor = ff__SmallFactor; b.solve = ff__SmallSolve;
+        break;
+    case FF_LINEAR_BANDED:
+        b.name = "band";  b.analyze = NULL;             b.factor = ff__BandFactor;  b.solve = ff__BandSolve;
+        break;
+    default:
+        b.name = "dense"; b.analyze = NULL;             b.factor = ff__DenseFactor; b.solve = ff__DenseSolve;
+        break;
+    }
+    return b;
+}
+
+#pragma endregion
+
+// The first `rows` packed Jacobian rows as seen by backends.
+static ff_JacobianView ffSketch__JacView(const ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    ff_JacobianView J;
+    J.rows        = rows;
+    J.cols        = cols;
+    J.nnz         = skt->jac_rowptr[rows];
+    J.row_ptr     = skt->jac_rowptr;
+    J.col         = skt->jac_col;
+    J.val         = skt->jac_val;
+    J.struct_rank = skt->struct_rank;
+    return J;
+}
+
+// Runs the backend's pattern analysis. A custom backend is analyzed once per
+// relink (and again if config.backend changes); built-in checks are cheap and
+// run every solve. Returns false if the backend cannot handle this pattern.
+static bool ffSketch__Analyze(ff_Sketch* skt, const ff_LinearBackend* b, const ff_JacobianView* J) {
+    if (!b->analyze) return true;
+    const bool custom = (b == skt->config.backend);
+    if (custom && skt->analyzed == b) return true;
+    if (!b->analyze(b->user, J)) {
+        FF_LOG("%s: cannot handle this system\n", b->name);
+        return false;
+    }
+    if (custom) skt->analyzed = b;
+    return true;
+}
+
+// Factors the current J with `primary`, or with the built-in least-squares
+// `fallback` when primary cannot (numerically singular LU, failing custom
+// backend). Returns the backend whose factorization is now current, and the
+// rank it found in `rank`.
+static const ff_LinearBackend* ffSketch__FactorJacobian(const ff_LinearBackend* primary, const ff_LinearBackend* fallback,
+                                                        const ff_JacobianView* J, uint16_t* rank) {
+    *rank = 0;
+    if (primary->factor(primary->user, J, rank)) {
+        FF_LOG("%s: rank %u of %ux%u\n", primary->name, *rank, J->rows, J->cols);
+        return primary;
+    }
+    FF_LOG("%s: factorization failed, %s step instead\n", primary->name, fallback->name);
+    fallback->factor(fallback->user, J, rank);
+    return fallback;
+}
+
+// Equilibration stops once every row and column max-norm is within
+// FF_EQUIL_TOL of 1, or after FF_EQUIL_SWEEPS sweeps.
+#define FF_EQUIL_SWEEPS 8
+#define FF_EQUIL_TOL    0.1
+
+// Scales the freshly evaluated J in place to R*J*C, with R and C kept in
+// skt->scale. Columns of parameters with a characteristic scale are multiplied
+// by it and left alone after that. FF_EQUIL_ROWS then divides every row by its
+// largest entry; other columns keep 1, so an under-constrained step stays the
+// minimum-norm one in parameter units. FF_EQUIL_RUIZ instead sweeps: each sweep
+// divides every row, then every column, by the square root of its largest
+// entry, which drives them all to unit max-norm. Empty rows and columns keep 1.
+static void ffSketch__Equilibrate(ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    ff_float* R    = skt->scale;
+    ff_float* C    = R + rows;
+    ff_float* f    = C + cols; //column factors of the current sweep
+    const uint32_t* rp  = skt->jac_rowptr;
+    const uint16_t* col = skt->jac_col;
+    ff_float*       val = skt->jac_val;
+
+    for (uint16_t r = 0; r < rows; r++) R[r] = 1.0;
+    for (uint16_t c = 0; c < cols; c++) C[c] = skt->tmp_params[c]->def.scale > 0.0 ? skt->tmp_params[c]->def.scale : 1.0;
+    for (uint32_t p = 0; p < rp[rows]; p++) val[p] *= C[col[p]];
+
+    if (skt->config.equilibrate == FF_EQUIL_ROWS) {
+        for (uint16_t r = 0; r < rows; r++) {
+            ff_float m = 0.0;
+            for (uint32_t p = rp[r]; p < rp[r + 1]; p++) if (fabs(val[p]) > m) m = fabs(val[p]);
+            if (!(m > 0.0)) continue;
+            R[r] = 1.0 / m;
+            for (uint32_t p = rp[r]; p < rp[r + 1]; p++) val[p] *= R[r];
+        }
+        return;
+    }
+
+    for (uint32_t sweep = 0; sweep < FF_EQUIL_SWEEPS; sweep++) {
+        ff_float worst = 0.0;
+        for (uint16_t r = 0; r < rows; r++) {
+            ff_float m = 0.0;
+            for (uint32_t p = rp[r]; p < rp[r + 1]; p++) if (fabs(val[p]) > m) m = fabs(val[p]);
+            if (!(m > 0.0)) continue;
+            if (fabs(m - 1.0) > worst) worst = fabs(m - 1.0);
+            const ff_float s = 1.0 / sqrt(m);
+            R[r] *= s;
+            for (uint32_t p = rp[r]; p < rp[r + 1]; p++) val[p] *= s;
+        }
+
+        for (uint16_t c = 0; c < cols; c++) f[c] = 0.0;
+        for (uint32_t p = 0; p < rp[rows]; p++) if (fabs(val[p]) > f[col[p]]) f[col[p]] = fabs(val[p]);
+        for (uint16_t c = 0; c < cols; c++) {
+            if (skt->tmp_params[c]->def.scale > 0.0 || !(f[c] > 0.0)) { f[c] = 1.0; continue; }
+            if (fabs(f[c] - 1.0) > worst) worst = fabs(f[c] - 1.0);
+            f[c] = 1.0 / sqrt(f[c]);
+            C[c] *= f[c];
+        }
+        for (uint32_t p = 0; p < rp[rows]; p++) val[p] *= f[col[p]];
+
+        if (worst <= FF_EQUIL_TOL) break;
+    }
+}
+
+// be->solve in the equilibrated space: (R*J*C) y = R*b, dx = C*y. bs is
+// scratch for the rows of R*b. Without equilibration b goes through as is.
+static void ffSketch__ScaledSolve(const ff_Sketch* skt, const ff_LinearBackend* be, const ff_JacobianView* J,
+                                  const ff_float* b, ff_float tol, ff_float* dx, ff_float* bs) {
+    if (skt->config.equilibrate == FF_EQUIL_NONE) {
+        be->solve(be->user, J, b, tol, dx);
+        return;
+    }
+    const ff_float* R = skt->scale;
+    const ff_float* C = R + J->rows;
+    for (uint16_t r = 0; r < J->rows; r++) bs[r] = R[r] * b[r];
+    be->solve(be->user, J, bs, tol, dx);
+    for (uint16_t c = 0; c < J->cols; c++) dx[c] *= C[c];
+}
+
+// dx += sum_i u_i * (y_i . b): the rank-one corrections accumulated since the
+// last Jacobian refresh (Broyden's "bad" inverse update, which needs no
+// transposed solves and so works with every factorization).
+static void ffSketch__ApplyBroyden(const ff_Sketch* skt, uint16_t rows, uint16_t cols, uint32_t count, const ff_float* b, ff_float* dx) {
+    const ff_float* pair = skt->broyden;
+    for (uint32_t i = 0; i < count; i++, pair += (size_t)rows + cols) {
+        const ff_float* y = pair;
+        const ff_float* u = pair + rows;
+        ff_float yb = 0.0;
+        for (uint16_t r = 0; r < rows; r++) yb += y[r] * b[r];
+        for (uint16_t c = 0; c < cols; c++) dx[c] += u[c] * yb;
+    }
+}
+
+// A row is dependent when elimination against the rows kept before it leaves
+// nothing above this fraction of its largest entry. Redundancy that holds
+// identically (duplicated or chained constraints) cancels to rounding level;
+// rows that are only nearly dependent stay in and are left to the pivot
+// skipping of the backends.
+#define FF_DEPENDENT_TOL 1e-8
+
+static void ff__HeapPush(uint16_t* heap, uint16_t* n, uint16_t v) {
+    uint16_t i = (*n)++;
+    while (i && heap[(i - 1) / 2] > v) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = v;
+}
 
-            uint16_t _p = 0;
-            for (uint16_t paramIdx = 0; paramIdx < skt->params.cap; paramIdx++) {
-                if (skt->params.slots[paramIdx].alive) {
-                    ff_ParamHandle pH = (ff_ParamHandle){ .idx = paramIdx, .gen = skt->params.slots[paramIdx].gen };
+static uint16_t ff__HeapPop(uint16_t* heap, uint16_t* n) {
+    const uint16_t top = heap[0];
+    const uint16_t v   = heap[--(*n)];
+    uint16_t i = 0;
+    for (;;) {
+        uint32_t c = 2u * i + 1;
+        if (c >= *n) break;
+        if (c + 1 < *n && heap[c + 1] < heap[c]) c++;
+        if (heap[c] >= v) break;
+        heap[i] = heap[c];
+        i = (uint16_t)c;
+    }
+    heap[i] = v;
+    return top;
+}
 
-                    cons->JMR.dervs[_p] = expr_derivative(cons->def.eq, pH, true);
-                    cons->JMR.dervs_y[_p] = 0.0;
+// Rank-revealing elimination over the rows of J, in the given order. Each row is reduced
+// against the rows kept so far, in the order they were kept (a min-heap of the
+// kept rows whose pivot column is nonzero, since fill can reach later pivots),
+// and marked in `dep` if nothing significant is left. Otherwise it is kept,
+// stored reduced with its largest remaining entry as pivot, which keeps the
+// cost to the fill of the echelon form. Returns the number of dependent rows.
+static uint16_t ffSketch__FindDependentRows(const ff_JacobianView* J, const uint16_t* order, uint8_t* dep) {
+    const uint16_t rows = J->rows, cols = J->cols;
+    ff_float* w      = calloc(cols ? cols : 1, sizeof(ff_float)); //row being reduced
+    uint16_t* pat    = malloc(sizeof(uint16_t) * (cols ? cols : 1));
+    uint8_t*  inpat  = calloc(cols ? cols : 1, 1);
+    uint16_t* piv_of = malloc(sizeof(uint16_t) * (cols ? cols : 1)); //column -> kept row pivoting on it
+    uint16_t* piv    = malloc(sizeof(uint16_t) * rows);              //kept row -> pivot column
+    uint32_t* ptr    = malloc(sizeof(uint32_t) * ((size_t)rows + 1)); //kept rows, pivot entry first
+    uint16_t* heap   = malloc(sizeof(uint16_t) * rows);
+    uint8_t*  queued = calloc(rows, 1);
+    uint32_t  cap    = J->nnz + 16;
+    uint16_t* ecol   = malloc(sizeof(uint16_t) * cap);
+    ff_float* eval   = malloc(sizeof(ff_float) * cap);
+    uint16_t  kept = 0, ndep = 0;
+
+    for (uint16_t c = 0; c < cols; c++) piv_of[c] = FF_INVALID_INDEX;
+    ptr[0] = 0;
+
+    for (uint16_t i = 0; i < rows; i++) {
+        const uint16_t r = order[i];
+        uint16_t np = 0, nh = 0;
+        ff_float rmax = 0.0;
+        for (uint32_t e = J->row_ptr[r]; e < J->row_ptr[r + 1]; e++) {
+            const uint16_t c = J->col[e];
+            w[c] = J->val[e];
+            pat[np++] = c;
+            inpat[c] = 1;
+            if (fabs(w[c]) > rmax) rmax = fabs(w[c]);
+            if (piv_of[c] != FF_INVALID_INDEX) {
+                queued[piv_of[c]] = 1;
+                ff__HeapPush(heap, &nh, piv_of[c]);
+            }
+        }
 
-                    _p++;
-                    if (_p >= par_cnt) break;
+        while (nh) {
+            const uint16_t k = ff__HeapPop(heap, &nh);
+            queued[k] = 0;
+            const ff_float f = w[piv[k]] / eval[ptr[k]];
+            if (f == 0.0) continue;
+            for (uint32_t e = ptr[k]; e < ptr[k + 1]; e++) {
+                const uint16_t c = ecol[e];
+                if (!inpat[c]) {
+                    inpat[c] = 1;
+                    pat[np++] = c;
+                    const uint16_t k2 = piv_of[c];
+                    if (k2 != FF_INVALID_INDEX && !queued[k2]) {
+                        queued[k2] = 1;
+                        ff__HeapPush(heap, &nh, k2);
+                    }
                 }
+                w[c] -= f * eval[e];
             }
-
+            w[piv[k]] = 0.0;
         }
-    }
 
-    uint16_t _p = 0; //todo find a better way to do dis
-    for (uint16_t paramIdx = 0; paramIdx < skt->params.cap; paramIdx++) {
-        if (skt->params.slots[paramIdx].alive) {
-            ff_Parameter* param = &skt->params.slots[paramIdx].payload;
-            skt->tmp_params[_p++] = param;
-            if (_p >= par_cnt) break;
+        ff_float left = 0.0;
+        uint16_t p = FF_INVALID_INDEX;
+        for (uint16_t i = 0; i < np; i++) {
+            if (fabs(w[pat[i]]) > left) { left = fabs(w[pat[i]]); p = pat[i]; }
         }
-    }
 
+        if (!(left > FF_DEPENDENT_TOL * rmax)) {
+            dep[r] = 1;
+            ndep++;
+        } else {
+            dep[r] = 0;
+            uint32_t ne = ptr[kept];
+            if (ne + np > cap) {
+                while (ne + np > cap) cap *= 2;
+                ecol = realloc(ecol, sizeof(uint16_t) * cap);
+                eval = realloc(eval, sizeof(ff_float) * cap);
+            }
+            ecol[ne] = p;
+            eval[ne++] = w[p];
+            for (uint16_t i = 0; i < np; i++) {
+                if (pat[i] != p && w[pat[i]] != 0.0) { ecol[ne] = pat[i]; eval[ne++] = w[pat[i]]; }
+            }
+            piv[kept] = p;
+            piv_of[p] = kept;
+            ptr[++kept] = ne;
+        }
 
-    skt->normal_mtr = malloc(sizeof(ff_float) * eq_cnt * eq_cnt);
-    skt->itrm_sol   = malloc(sizeof(ff_float) * eq_cnt);
-    skt->cached_params = malloc(sizeof(ff_float) * par_cnt);
+        for (uint16_t i = 0; i < np; i++) { w[pat[i]] = 0.0; inpat[pat[i]] = 0; }
+    }
 
-    skt->link_outdated = false;
+    free(w); free(pat); free(inpat); free(piv_of); free(piv);
+    free(ptr); free(heap); free(queued); free(ecol); free(eval);
+    return ndep;
 }
 
+// Reorders the packed Jacobian rows (pattern and values), tmp_contraints and cons_slot so
+// that row k is former row src[k], and repoints every JMR row.
+static void ffSketch__PermuteRows(ff_Sketch* skt, uint16_t rows, const uint16_t* src) {
+    const uint32_t  nnz    = skt->jac_rowptr[rows];
+    uint32_t*       rowptr = malloc(sizeof(uint32_t) * ((size_t)rows + 1));
+    uint16_t*       colidx = malloc(sizeof(uint16_t) * (nnz ? nnz : 1));
+    ff_float*       val    = malloc(sizeof(ff_float) * (nnz ? nnz : 1));
+    ff_Constraint** cons   = malloc(sizeof(ff_Constraint*) * rows);
+    uint16_t*       cslot  = malloc(sizeof(uint16_t) * rows);
+
+    uint32_t p = 0;
+    for (uint16_t k = 0; k < rows; k++) {
+        const uint16_t r  = src[k];
+        const uint32_t p0 = skt->jac_rowptr[r], len = skt->jac_rowptr[r + 1] - p0;
+        rowptr[k] = p;
+        cons[k]   = skt->tmp_contraints[r];
+        cslot[k]  = skt->cons_slot[r];
+        memcpy(colidx + p, skt->jac_col + p0, sizeof(uint16_t) * len);
+        memcpy(val + p, skt->jac_val + p0, sizeof(ff_float) * len);
+        p += len;
+    }
+    rowptr[rows] = p;
+
+    free(skt->jac_rowptr);
+    free(skt->jac_col);
+    free(skt->jac_val);
+    free(skt->tmp_contraints);
+    free(skt->cons_slot);
+    skt->jac_rowptr     = rowptr;
+    skt->jac_col        = colidx;
+    skt->jac_val        = val;
+    skt->tmp_contraints = cons;
+    skt->cons_slot      = cslot;
+    ffSketch__PointRows(skt);
+}
 
+static int ff__CompareU32(const void* a, const void* b) {
+    const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
 
+// Finds the dependent rows of the current (equilibrated) J and moves them
+// behind the others, so the first rows of every structure form the Newton
+// system from here on. The order is kept in dependent_perm for
+// ffSketch__RestoreRows. Returns the number of rows left in.
+static uint16_t ffSketch__SetAsideDependent(ff_Sketch* skt, uint16_t rows, uint16_t cols) {
+    const ff_JacobianView J = ffSketch__JacView(skt, rows, cols);
+    uint8_t*  dep   = malloc(rows);
+    uint16_t* order = malloc(sizeof(uint16_t) * (rows ? rows : 1));
+    uint32_t* key   = malloc(sizeof(uint32_t) * (rows ? rows : 1));
+
+    //rows in slot (creation) order: of a dependent set, the constraints added
+    //last are the ones flagged. Sorted rather than bucketed by slot, so a small
+    //part of a large sketch does not pay for the whole table
+    for (uint16_t r = 0; r < rows; r++) key[r] = ((uint32_t)skt->cons_slot[r] << 16) | r;
+    qsort(key, rows, sizeof(uint32_t), ff__CompareU32);
+    for (uint16_t r = 0; r < rows; r++) order[r] = (uint16_t)key[r];
+    free(key);
+
+    const uint16_t ndep = ffSketch__FindDependentRows(&J, order, dep);
+    free(order);
+    if (!ndep) {
+        free(dep);
+        return rows;
+    }
 
-// -=-=-=-=- High level push/pop -=-=-=-=- //
-
-
-
-// -=-=-=-=- High level getters / equality -=-=-=-=- //
+    uint16_t* src  = skt->dependent_perm;
+    uint16_t  kept = 0, tail = rows - ndep;
+    for (uint16_t r = 0; r < rows; r++) src[dep[r] ? tail++ : kept++] = r;
+    free(dep);
+    ffSketch__PermuteRows(skt, rows, src);
+
+    //row scales follow their rows (src[k] >= k for the kept ones); column scales
+    //sit right behind them
+    for (uint16_t k = 0; k < kept; k++) skt->scale[k] = skt->scale[src[k]];
+    memmove(skt->scale + kept, skt->scale + rows, sizeof(ff_float) * cols);
+    FF_LOG("%u dependent constraints set aside\n", ndep);
+    return kept;
+}
 
+// Puts the rows back in relink order, so the matching, the CSC map and the
+// symbolic cache describe them again.
+static void ffSketch__RestoreRows(ff_Sketch* skt, uint16_t rows) {
+    uint16_t* inv = malloc(sizeof(uint16_t) * rows);
+    for (uint16_t k = 0; k < rows; k++) inv[skt->dependent_perm[k]] = k;
+    ffSketch__PermuteRows(skt, rows, inv);
+    free(inv);
+}
 
-//Params
+// Lists the set-aside rows kept..rows-1 in skt->dependent: the ones the
+// solution satisfies anyway (redundant), then the others (conflicting).
+static void ffSketch__RecordDependent(ff_Sketch* skt, uint16_t kept, uint16_t rows, double tolerance) {
+    uint16_t n = 0;
+    for (int conflicting = 0; conflicting < 2; conflicting++) {
+        for (uint16_t r = kept; r < rows; r++) {
+            const ff_Constraint* cons = skt->tmp_contraints[r];
+            if (!(fabs(cons->JMR.err) <= tolerance) != (bool)conflicting) continue;
+            skt->dependent[n++] = ffSketch__RowHandle(skt, r);
+        }
+        if (!conflicting) skt->stats.redundant = n;
+    }
+    skt->stats.conflicting = n - skt->stats.redundant;
+}
 
+// A step this small relative to the parameters changes nothing representable:
+// two in a row without convergence mean the iteration has stalled.
+#define FF_STEP_TINY 1e-14
+
+// Convergence rate from the last three residual norms (f1, f2 < 0 when not
+// there yet): q = f/f1 against q1 = f1/f2. Quadratic convergence gives
+// log q ~ 2 log q1; anything short of 1.5 log q1 counts as linear.
+static enum ff_ConvergenceRate ff__ConvergenceRate(ff_float f, ff_float f1, ff_float f2, ff_float stall_ratio) {
+    if (!isfinite(f)) return FF_RATE_DIVERGING;
+    if (!(f1 > 0.0)) return FF_RATE_NONE;
+    const ff_float q = f / f1;
+    if (q * stall_ratio > 1.0) return FF_RATE_DIVERGING;
+    if (q >= stall_ratio) return FF_RATE_STALLED;
+    if (f2 > 0.0 && f1 < f2 && log(q) <= 1.5 * log(f1 / f2)) return FF_RATE_QUADRATIC;
+    return FF_RATE_LINEAR;
+}
 
+// Value of an expression and, in *dv, its derivative along v (indexed by
+// parameter slot), by forward propagation through the tree.
+static ff_float ffExpr__Directional(const ff_Expr* expr, const ff_param__table* t, const ff_float* v, ff_float* dv) {
+    ff_float da = 0.0, db = 0.0, a, b;
+    switch (expr->op_type) {
+        case OperatorType_CONST: *dv = 0.0; return expr->value;
+        case OperatorType_PARAM: *dv = v[expr->param_H.idx]; return ff_paramTBL_get_const(t, expr->param_H)->def.v;
+        case OperatorType_EXTR_PARAM: return ffExpr__Directional(expr->a, t, v, dv);
+        case OperatorType_ADD: a = ffExpr__Directional(expr->a, t, v, &da); b = ffExpr__Directional(expr->b, t, v, &db); *dv = da + db; return a + b;
+        case OperatorType_SUB: a = ffExpr__Directional(expr->a, t, v, &da); b = ffExpr__Directional(expr->b, t, v, &db); *dv = da - db; return a - b;
+        case OperatorType_MUL: a = ffExpr__Directional(expr->a, t, v, &da); b = ffExpr__Directional(expr->b, t, v, &db); *dv = da * b + a * db; return a * b;
+        case OperatorType_DIV: a = ffExpr__Directional(expr->a, t, v, &da); b = ffExpr__Directional(expr->b, t, v, &db); *dv = (da * b - a * db) / (b * b); return a / b;
+        case OperatorType_SIN: a = ffExpr__Directional(expr->a, t, v, &da); *dv = cos(a) * da; return sin(a);
+        case OperatorType_COS: a = ffExpr__Directional(expr->a, t, v, &da); *dv = -sin(a) * da; return cos(a);
+        case OperatorType_ASIN: a = ffExpr__Directional(expr->a, t, v, &da); *dv = da / sqrt(1.0 - a * a); return asin(a);
+        case OperatorType_ACOS: a = ffExpr__Directional(expr->a, t, v, &da); *dv = -da / sqrt(1.0 - a * a); return acos(a);
+        case OperatorType_SQRT: a = sqrt(ffExpr__Directional(expr->a, t, v, &da)); *dv = da / (2.0 * a); return a;
+        case OperatorType_SQR: a = ffExpr__Directional(expr->a, t, v, &da); *dv = 2.0 * a * da; return a * a;
+        default: break;
+    }
+    *dv = 0.0;
+    return 0.0;
+}
 
+// Degree of an expression as a polynomial in the system's own parameters, or
+// -1 if it is not one (one of them under sin, sqrt, in a divisor...).
+static int ffExpr__Degree(const ff_Expr* expr, const ff_Sketch* skt) {
+    int a, b;
+    switch (expr->op_type) {
+        case OperatorType_CONST: return 0;
+        case OperatorType_PARAM: return ffSketch__ParamCol(skt, expr->param_H.idx) != FF_INVALID_INDEX;
+        case OperatorType_EXTR_PARAM: return ffExpr__Degree(expr->a, skt);
+        case OperatorType_ADD:
+        case OperatorType_SUB:
+            a = ffExpr__Degree(expr->a, skt); b = ffExpr__Degree(expr->b, skt);
+            return (a < 0 || b < 0) ? -1 : (a > b ? a : b);
+        case OperatorType_MUL:
+            a = ffExpr__Degree(expr->a, skt); b = ffExpr__Degree(expr->b, skt);
+            return (a < 0 || b < 0) ? -1 : a + b;
+        case OperatorType_DIV:
+            a = ffExpr__Degree(expr->a, skt); b = ffExpr__Degree(expr->b, skt);
+            return (a < 0 || b != 0) ? -1 : a;
+        case OperatorType_SQR:
+            a = ffExpr__Degree(expr->a, skt);
+            return a < 0 ? -1 : 2 * a;
+        case OperatorType_SIN:
+        case OperatorType_COS:
+        case OperatorType_ASIN:
+        case OperatorType_ACOS:
+        case OperatorType_SQRT:
+            return ffExpr__Degree(expr->a, skt) == 0 ? 0 : -1;
+        default: return -1;
+    }
+}
 
+// Root of a u^2 + b u + c nearest to u = 0 (the smaller one, taken without
+// cancellation); false if there is no real one.
+static bool ff__NearestRoot(ff_float a, ff_float b, ff_float c, ff_float* u) {
+    if (a == 0.0) {
+        if (b == 0.0) return false;
+        *u = -c / b;
+        return isfinite(*u);
+    }
+    const ff_float d = b * b - 4.0 * a * c;
+    if (!(d >= 0.0)) return false;
+    const ff_float q = -0.5 * (b + copysign(sqrt(d), b));
+    *u = (q == 0.0) ? 0.0 : c / q; //q = 0 only for b = c = 0
+    return isfinite(*u);
+}
 
+// Coefficients of row r as a polynomial of degree deg <= 2 around x0 in the
+// offsets (u, v) of the system's one or two parameters:
+// k = {u^2, uv, v^2, u, v, 1}. Exact up to rounding, from six evaluations;
+// leaves the parameters moved.
+static void ffSketch__RowPolynomial(ff_Sketch* skt, uint16_t r, int deg, const ff_float* x0, ff_float* k) {
+    const ff_Expr* eq  = skt->tmp_contraints[r]->def.eq;
+    const bool     two = skt->params.alive_count > 1;
+    const ff_float at[5][2] = { {0.0, 0.0}, {1.0, 0.0}, {-1.0, 0.0}, {0.0, 1.0}, {0.0, -1.0} };
+    ff_float f[6];
+    for (int i = 0; i < (two ? 6 : 3); i++) {
+        skt->tmp_params[0]->def.v = x0[0] + (i < 5 ? at[i][0] : 1.0);
+        if (two) skt->tmp_params[1]->def.v = x0[1] + (i < 5 ? at[i][1] : 1.0);
+        f[i] = expr_evaluate((ff_Expr*)eq, &skt->params);
+    }
 
-#pragma region SOLVING
+    k[0] = (deg == 2) ? 0.5 * (f[1] + f[2]) - f[0] : 0.0;
+    k[3] = 0.5 * (f[1] - f[2]);
+    k[5] = f[0];
+    k[1] = k[2] = k[4] = 0.0;
+    if (!two) return;
+    k[2] = (deg == 2) ? 0.5 * (f[3] + f[4]) - f[0] : 0.0;
+    k[4] = 0.5 * (f[3] - f[4]);
+    k[1] = (deg == 2) ? f[5] - f[0] - k[3] - k[4] - k[0] - k[2] : 0.0;
+}
 
+// Moves the parameters in slots up[0..n) by sign * carry[slot].
+static inline void ffSketch__ShiftSlots(ff_Sketch* skt, const uint16_t* up, uint16_t n, const ff_float* carry, ff_float sign) {
+    for (uint16_t i = 0; i < n; i++) skt->params.slots[up[i]].payload.def.v += sign * carry[up[i]];
+}
 
+// Where the coupled first step (see ffSketch__SolveSystem) takes a system of
+// one or two parameters: x0 - J^-1 (F + J_up carry), with F and J taken
+// where the upstream blocks started. x0 stays put if that J is singular.
+static void ffSketch__CarriedStart(ff_Sketch* skt, const ff_float* carry, const uint16_t* up, uint16_t n_up, ff_float* x0) {
+    const uint16_t n = skt->params.alive_count;
+    ff_float J[2][2] = { {0.0, 0.0}, {0.0, 0.0} }, f[2];
+    ffSketch__ShiftSlots(skt, up, n_up, carry, -1.0);
+    for (uint16_t r = 0; r < n; r++) {
+        const ff_Constraint* cons = skt->tmp_contraints[r];
+        ff_float dv = 0.0;
+        f[r] = ffExpr__Directional(cons->def.eq, &skt->params, carry, &dv) + dv;
+        for (uint16_t k = 0; k < cons->JMR.dervs_cnt; k++) J[r][cons->JMR.dervs_col[k]] = expr_evaluate(cons->JMR.dervs[k], &skt->params);
+    }
+    ffSketch__ShiftSlots(skt, up, n_up, carry, 1.0);
+    const ff_float det = (n == 1) ? J[0][0] : J[0][0] * J[1][1] - J[0][1] * J[1][0];
+    if (!(fabs(det) > 0.0) || !isfinite(det)) return;
+    if (n == 1) {
+        x0[0] -= f[0] / det;
+    } else {
+        x0[0] -= (J[1][1] * f[0] - J[0][1] * f[1]) / det;
+        x0[1] -= (J[0][0] * f[1] - J[1][0] * f[0]) / det;
+    }
+}
 
-static inline bool ffSketch_calcError(ff_Sketch* skt, double tolerance) {
-    bool converged = true;
+// Closed-form root of a square system of one or two parameters whose rows are
+// polynomials of degree <= 2 in them: a distance or a line for one parameter,
+// two lines, a line and a circle, two circles (or any two conics with the
+// same quadratic part) for two. Of the roots, the one nearest the current
+// values, or for a block after others (carry, up as for the Newton solve)
+// nearest where the coupled first step would take it, which keeps the branch
+// the block was on. False when the system is none of these or has no real
+// root; the parameters are left as they were.
+static bool ffSketch__ClosedForm(ff_Sketch* skt, const ff_float* carry, const uint16_t* up, uint16_t n_up, ff_float* x) {
+    const uint16_t n = skt->params.alive_count;
+    if (n > 2 || skt->constraints.alive_count != n) return false;
+    int deg[2];
+    for (uint16_t r = 0; r < n; r++) {
+        deg[r] = ffExpr__Degree(skt->tmp_contraints[r]->def.eq, skt);
+        if (deg[r] < 1 || deg[r] > 2) return false;
+    }
+    ff_float orig[2] = { 0.0, 0.0 }, x0[2] = { 0.0, 0.0 }, k[2][6] = { { 0.0 } };
+    for (uint16_t c = 0; c < n; c++) orig[c] = x0[c] = skt->tmp_params[c]->def.v;
+    if (n_up) ffSketch__CarriedStart(skt, carry, up, n_up, x0);
+    for (uint16_t r = 0; r < n; r++) ffSketch__RowPolynomial(skt, r, deg[r], x0, k[r]);
+    for (uint16_t c = 0; c < n; c++) skt->tmp_params[c]->def.v = orig[c];
+    for (uint16_t c = 0; c < n; c++) x[c] = x0[c];
+
+    ff_float u = 0.0, v = 0.0;
+    if (n == 1) {
+        if (!ff__NearestRoot(k[0][0], k[0][3], k[0][5], &u)) return false;
+        x[0] += u;
+        return true;
+    }
 
-    for (uint16_t i = 0; i < skt->constraints.alive_count; i++) {
-        ff_Constraint* cons = skt->tmp_contraints[i];
-        cons->JMR.err = expr_evaluate(cons->def.eq, &skt->params);
-        if (fabs(cons->JMR.err) > tolerance) converged = false;           
-        printf("Constraint %d error: %f\n", i, cons->JMR.err);
+    //a combination of the rows without quadratic part: a line, unless the
+    //quadratic parts differ in shape
+    const ff_float* quad = k[0];
+    ff_float        lin[6];
+    const ff_float  n0 = fabs(k[0][0]) + fabs(k[0][1]) + fabs(k[0][2]);
+    const ff_float  n1 = fabs(k[1][0]) + fabs(k[1][1]) + fabs(k[1][2]);
+    if (n0 == 0.0 || n1 == 0.0) {
+        memcpy(lin, n0 == 0.0 ? k[0] : k[1], sizeof(lin));
+        quad = n0 == 0.0 ? k[1] : k[0];
+    } else {
+        int j = 0;
+        for (int i = 1; i < 3; i++) if (fabs(k[0][i]) > fabs(k[0][j])) j = i;
+        const ff_float ratio = k[1][j] / k[0][j];
+        for (int i = 0; i < 3; i++) if (fabs(k[1][i] - ratio * k[0][i]) > 1e-8 * n1) return false;
+        for (int i = 0; i < 6; i++) lin[i] = (i < 3) ? 0.0 : k[1][i] - ratio * k[0][i];
     }
 
-    return converged;
+    //the line as p + s w, p its point nearest the current values, then the
+    //other row along it: a u^2 + b u + c in s
+    const ff_float g = lin[3] * lin[3] + lin[4] * lin[4];
+    if (!(g > 0.0)) return false;
+    const ff_float pu = -lin[5] * lin[3] / g, pv = -lin[5] * lin[4] / g;
+    const ff_float wu = -lin[4] / sqrt(g), wv = lin[3] / sqrt(g);
+    const ff_float a = quad[0] * wu * wu + quad[1] * wu * wv + quad[2] * wv * wv;
+    const ff_float b = 2.0 * quad[0] * pu * wu + quad[1] * (pu * wv + pv * wu) + 2.0 * quad[2] * pv * wv + quad[3] * wu + quad[4] * wv;
+    const ff_float c = quad[0] * pu * pu + quad[1] * pu * pv + quad[2] * pv * pv + quad[3] * pu + quad[4] * pv + quad[5];
+    ff_float s;
+    if (!ff__NearestRoot(a, b, c, &s)) return false;
+    u = pu + s * wu;
+    v = pv + s * wv;
+    x[0] += u;
+    x[1] += v;
+    return true;
 }
 
-bool ffSketch_Solve(ff_Sketch* skt, double tolerance, uint32_t max_steps) {
+// When a solve has to stop between iterations: at a wall-clock deadline
+// (ffSketch_SolveTimed), or once a background solve is cancelled.
+typedef struct ff_SolveLimit {
+    uint64_t         deadline; //0 = none
+#if FF_THREADS
+    pthread_mutex_t* lock;     //guards *cancel
+    const bool*      cancel;   //NULL = cannot be cancelled
+#endif
+} ff_SolveLimit;
+
+static bool ffSolveLimit__Reached(const ff_SolveLimit* limit) {
+    if (!limit) return false;
+    if (limit->deadline && ff__NowUs() >= limit->deadline) return true;
+#if FF_THREADS
+    if (limit->cancel) {
+        pthread_mutex_lock(limit->lock);
+        const bool cancel = *limit->cancel;
+        pthread_mutex_unlock(limit->lock);
+        return cancel;
+    }
+#endif
+    return false;
+}
 
-    ffSketch_tryRelink(skt);
+// Newton solve of one linked system: the whole sketch, or one of its parts.
+// A block after others in its component passes how far they moved (carry, by
+// parameter slot) and the slots of theirs its rows use (up[0..n_up)): its
+// first step is then the one of the coupled system, taken where the upstream
+// blocks started, so the block follows them on the same branch instead of
+// starting from positions they have left. With resume the solve goes on from
+// where a paused one stopped (skt->paused), on the rows and factorization it
+// left.
+static bool ffSketch__SolveSystem(ff_Sketch* skt, double tolerance, uint32_t max_steps,
+                                  const ff_float* carry, const uint16_t* up, uint16_t n_up, const ff_SolveLimit* limit, bool resume) {
 
     uint16_t  rows = skt->constraints.alive_count;
     uint16_t  cols = skt->params.alive_count;
-    
-    if (!(rows && cols)) return true;
 
-    double temp = 0.0;
+    skt->stats.result     = FF_SOLVE_CONVERGED;
+    skt->stats.rate       = FF_RATE_NONE;
+    skt->stats.residual   = 0.0;
+    skt->stats.step_norm  = 0.0;
+    skt->stats.iterations = 0;
+    if (!resume) {
+        skt->stats.closed_form = 0;
+        skt->solve_state.factored = false;
+    }
+
+    //nothing to adjust: constraints on no parameter hold or they don't
+    if (!cols) {
+        if (rows && !ffSketch_calcError(skt, rows, tolerance)) skt->stats.result = FF_SOLVE_CONFLICTING;
+        return skt->stats.result == FF_SOLVE_CONVERGED;
+    }
+    if (!rows) return true;
+
     const double epsilon = 1e-10;
 
-    bool converged = false;
+    enum ff_SolveResult result = FF_SOLVE_MAX_STEPS;
+
+    skt->solve_state.form    = ffSketch__PickNormalForm(skt, rows, cols);
+    skt->solve_state.mixed   = skt->config.precision == FF_PRECISION_MIXED;
+    skt->solve_state.epsilon = epsilon;
+
+    //Backend for this solve, plus the built-in least-squares one used whenever
+    //it cannot handle the system or a particular iterate
+    const char*                reason   = NULL;
+    const char*                lsq_why  = NULL;
+    enum ff_LinearMethod       method   = ffSketch__PickLinear(skt, rows, cols, &reason);
+    const enum ff_LinearMethod lsq      = ffSketch__PickLeastSquares(skt, &lsq_why);
+    const ff_LinearBackend     fallback = ffSketch_BuiltinBackend(skt, lsq);
+    ff_JacobianView            jac      = ffSketch__JacView(skt, rows, cols);
+    ff_LinearBackend           primary  = (method == FF_LINEAR_CUSTOM) ? *skt->config.backend : ffSketch_BuiltinBackend(skt, method);
+    if (!ffSketch__Analyze(skt, method == FF_LINEAR_CUSTOM ? skt->config.backend : &primary, &jac)) {
+        //e.g. FF_LINEAR_SMALL asked for on more than FF_SMALL_MAX unknowns
+        primary = fallback;
+        method  = lsq;
+        reason  = "config.linear cannot handle this system, least-squares fallback";
+    }
+    const ff_LinearBackend*    active   = &primary;
+
+    //A paused solve left its rows in relink order: the dependent ones it set
+    //aside go behind the others again, as the factorization it kept has them
+    if (resume && skt->paused.kept < rows) {
+        ffSketch__PermuteRows(skt, rows, skt->dependent_perm);
+        jac = ffSketch__JacView(skt, skt->paused.kept, cols);
+        jac.struct_rank = skt->paused.kept;
+        skt->solve_state.form = ffSketch__PickNormalForm(skt, skt->paused.kept, cols);
+        const ff_LinearBackend* analyzer = (method == FF_LINEAR_CUSTOM) ? skt->config.backend : &primary;
+        skt->analyzed = NULL;
+        if (method == FF_LINEAR_LU || !ffSketch__Analyze(skt, analyzer, &jac)) primary = fallback;
+        skt->analyzed = NULL;
+    }
 
+    skt->stats.method     = method;
+    skt->stats.reason     = reason;
+    skt->stats.backend    = active->name;
+    FF_LOG("Linear method %d (%s), fallback %s (%s)\n", method, reason, fallback.name, lsq_why);
+    (void)lsq_why;
+
+    //scratch: step | backend work: LSQR vectors (rows + 4*cols) or dense work and rhs (2*max(rows, cols))
+    //         | F | previous F | Broyden H*y | scaled right-hand side
+    ff_float* step      = skt->scratch;
+    ff_float* fvec      = ffSketch__Work(skt, cols) + 2 * (size_t)rows + 4 * (size_t)cols;
+    ff_float* fprev     = fvec + rows;
+    ff_float* hy        = fprev + rows;
+    ff_float* bs        = hy + cols;
+
+    //Jacobian reuse (chord / Broyden): J is evaluated and factored on the first
+    //iteration and again only when the residual stops shrinking fast enough
+    const enum ff_JacobianUpdate update = skt->config.jacobian_update;
+    const uint32_t max_reuse = skt->config.jacobian_max_reuse;
+    if (update == FF_JACOBIAN_BROYDEN) {
+        const size_t need = (size_t)max_reuse * ((size_t)rows + cols);
+        if (skt->broyden_cap < need) {
+            free(skt->broyden);
+            skt->broyden = malloc(sizeof(ff_float) * need);
+            skt->broyden_cap = need;
+        }
+    }
+    //A system with a closed-form root starts from it: the first iteration
+    //then only checks it and factors J there
+    ff_float closed[2] = { 0.0, 0.0 };
+    const bool use_closed = !resume && skt->config.closed_form && ffSketch__ClosedForm(skt, carry, up, n_up, closed);
+    if (use_closed) {
+        for (uint16_t c = 0; c < cols; c++) skt->tmp_params[c]->def.v = closed[c];
+        skt->stats.closed_form = 1;
+        n_up = 0;
+    }
 
+    bool     refresh   = true;
+    bool     stale     = false; //last step came from a reused Jacobian
+    uint32_t reused    = 0;
+    uint32_t n_broyden = 0;
+
+    //Inexact Newton forcing term (Eisenstat-Walker choice 2)
+    ff_float eta = skt->config.forcing_max;
+    ff_float fnorm_prev = -1.0;
+
+    //Convergence monitoring: consecutive iterations in which ||F|| stayed
+    //flat, iterations since ||F|| last improved on its best by stall_ratio,
+    //and steps below rounding level. Undamped Newton may wander above its
+    //best residual for a while, but one that oscillates (an infeasible
+    //sketch) never sets a new best and is stopped after stall_window.
+    const uint32_t window      = skt->config.stall_window;
+    ff_float       fnorm_prev2 = -1.0;
+    ff_float       fnorm_best  = -1.0;
+    uint32_t       flat        = 0;
+    uint32_t       since_best  = 0;
+    uint32_t       tiny_steps  = 0;
+
+    if (resume) {
+        //J is refreshed anyway if the factorization went, was redone meanwhile
+        //(see ffSketch__RefreshFactor), or sits in a custom backend that may
+        //have factored another part since
+        refresh     = skt->paused.refresh || !skt->solve_state.factored || method == FF_LINEAR_CUSTOM;
+        stale       = skt->paused.stale && !refresh;
+        reused      = skt->paused.reused;
+        n_broyden   = refresh ? 0 : skt->paused.n_broyden;
+        eta         = skt->paused.eta;
+        fnorm_prev  = skt->paused.fnorm_prev;
+        fnorm_prev2 = skt->paused.fnorm_prev2;
+        fnorm_best  = skt->paused.fnorm_best;
+        flat        = skt->paused.flat;
+        since_best  = skt->paused.since_best;
+        tiny_steps  = skt->paused.tiny_steps;
+        if (!refresh) active = &skt->solve_state.backend;
+    }
 
 
-    for (uint32_t step = 0; step < max_steps; step++) {
+    for (uint32_t step_i = 0; step_i < max_steps; step_i++) {
 
-        printf("* Iteration (%d/%d)\n", step + 1, max_steps);
+        FF_LOG("* Iteration (%d/%d)\n", step_i + 1, max_steps);
       
 
         //Calculate error of system. If we are converged we are done.
-        if (ffSketch_calcError(skt, tolerance)) {
-            converged = true;
-            break;
+        const bool carried = step_i == 0 && n_up;
+        if (carried) ffSketch__ShiftSlots(skt, up, n_up, carry, -1.0);
+        const bool done = ffSketch_calcError(skt, jac.rows, tolerance) && !carried && !(use_closed && step_i == 0);
+        if (carried) {
+            //F at the upstream start plus its change along the upstream moves
+            for (uint16_t r = 0; r < rows; r++) {
+                ff_float dv = 0.0;
+                ffExpr__Directional(skt->tmp_contraints[r]->def.eq, &skt->params, carry, &dv);
+                skt->tmp_contraints[r]->JMR.err += dv;
+            }
         }
 
-        for (uint16_t i = 0; i < skt->constraints.alive_count; i++) {
-            ff_Constraint* cons = skt->tmp_contraints[i];
-            for (uint16_t p = 0; p < skt->params.alive_count; p++) {
-                cons->JMR.dervs_y[p] = expr_evaluate(cons->JMR.dervs[p], &skt->params);
-                printf("D= %f\n", cons->JMR.dervs_y[p]);
-            }
+        for (uint16_t r = 0; r < jac.rows; r++) fvec[r] = skt->tmp_contraints[r]->JMR.err;
+        ff_float fnorm = ff__norm2(fvec, jac.rows);
+        skt->stats.residual = fnorm;
+        skt->stats.rate     = ff__ConvergenceRate(fnorm, fnorm_prev, fnorm_prev2, skt->config.stall_ratio);
+        FF_LOG("|F| = %g, rate %d\n", fnorm, skt->stats.rate);
+
+        if (done) {
+            result = FF_SOLVE_CONVERGED;
+            break;
+        }
+        if (!isfinite(fnorm)) {
+            if (carried) ffSketch__ShiftSlots(skt, up, n_up, carry, 1.0);
+            result = FF_SOLVE_DIVERGED;
+            break;
+        }
+        flat = (skt->stats.rate == FF_RATE_STALLED) ? flat + 1 : 0;
+        if (fnorm_best < 0.0 || fnorm < skt->config.stall_ratio * fnorm_best) {
+            fnorm_best = fnorm;
+            since_best = 0;
+        } else if (window && ++since_best >= window) {
+            //ending well above the best it reached counts as diverging
+            FF_LOG("|F| no better than %g for %u iterations, giving up\n", fnorm_best, since_best);
+            result = (fnorm * skt->config.stall_ratio > fnorm_best) ? FF_SOLVE_DIVERGED : FF_SOLVE_STALLED;
+            break;
+        }
+        if ((window && flat >= window) || tiny_steps >= 2) {
+            FF_LOG("|F| flat for %u iterations, giving up\n", flat);
+            result = FF_SOLVE_STALLED;
+            break;
         }
-  
-        //Solve by least squares:
 
-        //Start
-        for (int r = 0; r < rows; r++) {
-            for (int c = 0; c < rows; c++) {
-                double sum = 0.0;
-                for (int i = 0; i < cols; i++) {
-                    double cV = skt->tmp_contraints[c]->JMR.dervs_y[i];
-                    double rV = skt->tmp_contraints[r]->JMR.dervs_y[i];
-                    if (cV == 0.0 || rV == 0.0) continue;    
-                    sum += rV * cV;
+        if (update != FF_JACOBIAN_EXACT && !refresh) {
+            if (reused >= max_reuse || fnorm > skt->config.jacobian_stall * fnorm_prev) {
+                FF_LOG("Jacobian refresh after %u reuses (|F| %g -> %g)\n", reused, fnorm_prev, fnorm);
+                refresh = true;
+                if (stale && fnorm > fnorm_prev) {
+                    //the stale step made things worse: take it back and redo it exactly
+                    for (int c = 0; c < cols; c++) skt->tmp_params[c]->def.v += step[c];
+                    ffSketch_calcError(skt, jac.rows, tolerance);
+                    memcpy(fvec, fprev, sizeof(ff_float) * jac.rows);
+                    fnorm = fnorm_prev;
+                }
+            } else if (update == FF_JACOBIAN_BROYDEN) {
+                //secant condition H*y = s for the step just taken, s = -step
+                ff_float* y = skt->broyden + (size_t)n_broyden * ((size_t)jac.rows + cols);
+                ff_float* u = y + jac.rows;
+                ff_float yy = 0.0;
+                for (uint16_t r = 0; r < jac.rows; r++) { y[r] = fvec[r] - fprev[r]; yy += y[r] * y[r]; }
+                if (yy > 0.0) {
+                    ffSketch__ScaledSolve(skt, active, &jac, y, eta, hy, bs);
+                    ffSketch__ApplyBroyden(skt, jac.rows, cols, n_broyden, y, hy);
+                    for (uint16_t c = 0; c < cols; c++) u[c] = (-step[c] - hy[c]) / yy;
+                    n_broyden++;
                 }
-                skt->normal_mtr[r + c * rows] = sum;
             }
         }
-        
-          
-        //Gaussian Solve
-        for (int row = 0; row < rows; row++) {
-            int pivot_row = row;
-            double max_value = 0.0;
-    
-            // Find the pivot row (max absolute value in column)
-            for (int candidate_row = row; candidate_row < rows; candidate_row++) {
-                if (candidate_row >= rows) ff_ERROR("Bounds error");  //todo will these bounds errors ever fire?
-                if (fabs(skt->normal_mtr[candidate_row + row * rows]) > max_value) {
-                    max_value = fabs(skt->normal_mtr[candidate_row + row * rows]);
-                    pivot_row = candidate_row;
+
+        if (update == FF_JACOBIAN_EXACT || refresh) {
+            for (uint16_t i = 0; i < jac.rows; i++) {
+                ff_Constraint* cons = skt->tmp_contraints[i];
+                for (uint16_t p = 0; p < cons->JMR.dervs_cnt; p++) {
+                    cons->JMR.dervs_y[p] = expr_evaluate(cons->JMR.dervs[p], &skt->params);
+                    FF_LOG("D= %f\n", cons->JMR.dervs_y[p]);
                 }
             }
-    
-            if (max_value < epsilon) {
-                printf("Small pivot element: %f at row %d\n", max_value, row);
-                continue;
-            }
-    
-            // Swap rows in the normal matrix
-            for (int col = 0; col < rows; col++) {
-                temp = skt->normal_mtr[row + col * rows];
-                skt->normal_mtr[row + col * rows] = skt->normal_mtr[pivot_row + col * rows];
-                skt->normal_mtr[pivot_row + col * rows] = temp;
-            }
-    
-            // Swap elements in the constraint error vector
-            temp = skt->tmp_contraints[row]->JMR.err;
-            skt->tmp_contraints[row      ]->JMR.err = skt->tmp_contraints[pivot_row]->JMR.err;
-            skt->tmp_contraints[pivot_row]->JMR.err = temp;
-    
-            // Eliminate entries below the pivot
-            for (int target_row = row + 1; target_row < rows; target_row++) {
-                if(target_row >= rows) ff_ERROR("Bounds error"); //todo will these bounds errors ever fire?
-                if (fabs(skt->normal_mtr[row + row * rows]) < epsilon) {
-                    printf("Division by zero at row %d\n", row);
-                    continue;
+            //the factorization (and every step until the next refresh) works on R*J*C
+            if (skt->config.equilibrate != FF_EQUIL_NONE) ffSketch__Equilibrate(skt, jac.rows, cols);
+            uint16_t rank = 0;
+            active    = ffSketch__FactorJacobian(&primary, &fallback, &jac, &rank);
+
+            //A rank-deficient first factorization: find out which constraints
+            //depend on the others and leave them out of every later step
+            if (step_i == 0 && !resume && skt->config.detect_dependent) {
+                skt->stats.redundant   = 0;
+                skt->stats.conflicting = 0;
+                const uint16_t kept = rank < rows ? ffSketch__SetAsideDependent(skt, rows, cols) : rows;
+                if (!kept) { //every row is zero: nothing left to step on
+                    if (carried) ffSketch__ShiftSlots(skt, up, n_up, carry, 1.0);
+                    break;
                 }
-                double coefficient = skt->normal_mtr[target_row + row * rows] / skt->normal_mtr[row + row * rows];
-                for (int col = 0; col < rows; col++) {
-                    skt->normal_mtr[target_row + col* rows] -= skt->normal_mtr[row + col* rows] * coefficient;
+                if (kept < rows) {
+                    jac = ffSketch__JacView(skt, kept, cols);
+                    jac.struct_rank = kept; //numerically independent rows
+                    skt->solve_state.form = ffSketch__PickNormalForm(skt, kept, cols);
+
+                    //the LU's CSC map and the custom backend's analysis describe the full J
+                    const ff_LinearBackend* analyzer = (method == FF_LINEAR_CUSTOM) ? skt->config.backend : &primary;
+                    skt->analyzed = NULL;
+                    if (method == FF_LINEAR_LU || !ffSketch__Analyze(skt, analyzer, &jac)) primary = fallback;
+                    skt->analyzed = NULL;
+                    active = ffSketch__FactorJacobian(&primary, &fallback, &jac, &rank);
+
+                    for (uint16_t r = 0; r < kept; r++) fvec[r] = skt->tmp_contraints[r]->JMR.err;
+                    fnorm = ff__norm2(fvec, kept);
                 }
-                skt->tmp_contraints[target_row]->JMR.err -= skt->tmp_contraints[row]->JMR.err * coefficient;
             }
+            skt->stats.backend = active->name;
+            skt->solve_state.rows     = jac.rows;
+            skt->solve_state.backend  = *active;
+            skt->solve_state.factored = true;
+            skt->solve_state.current  = true;
+            refresh   = false;
+            stale     = false;
+            reused    = 0;
+            n_broyden = 0;
+        } else {
+            stale = true;
+            reused++;
         }
 
-              
-        //Back sub
-        for (int row = rows - 1; row >= 0; row--) {
-            if (fabs(skt->normal_mtr[row + row * rows]) < epsilon) {
-                printf("Back substitution failed at row %d\n", row);
-                continue;
-            }
-    
-            ff_float solution_value = skt->tmp_contraints[row]->JMR.err / skt->normal_mtr[row + row * rows];
-            for (int prev_row = rows - 1; prev_row > row; prev_row--) {
-                solution_value -= skt->itrm_sol[prev_row] * skt->normal_mtr[row + prev_row * rows] / skt->normal_mtr[row + row * rows];
-            }
-            skt->itrm_sol[row] = solution_value;
+        //forcing term for iterative backends; direct ones ignore it
+        if (fnorm_prev > 0.0) {
+            const ff_float ratio = fnorm / fnorm_prev;
+            ff_float eta_new = 0.9 * ratio * ratio;
+            if (0.9 * eta * eta > 0.1 && 0.9 * eta * eta > eta_new) eta_new = 0.9 * eta * eta;
+            eta = eta_new < skt->config.forcing_max ? eta_new : skt->config.forcing_max;
         }
+        //don't oversolve past what the convergence test can see
+        if (eta < 0.5 * tolerance / fnorm) eta = 0.5 * tolerance / fnorm;
+
+        ffSketch__ScaledSolve(skt, active, &jac, fvec, eta, step, bs);
+        if (n_broyden) ffSketch__ApplyBroyden(skt, jac.rows, cols, n_broyden, fvec, step);
+        if (carried) ffSketch__ShiftSlots(skt, up, n_up, carry, 1.0);
 
         //Update parameters based on this steps corrections
+        ff_float xnorm = 0.0;
         for (int c = 0; c < cols; c++) {
-            ff_float corr = 0.0;
-            for (int r = 0; r < rows; r++) {
-                corr += skt->itrm_sol[r] * skt->tmp_contraints[r]->JMR.dervs_y[c];
-            }
-            printf("Correction is %f\n", corr);
-            skt->tmp_params[c]->def.v -= corr;
+            FF_LOG("Correction is %f\n", step[c]);
+            skt->tmp_params[c]->def.v -= step[c];
+            xnorm += skt->tmp_params[c]->def.v * skt->tmp_params[c]->def.v;
+        }
+        skt->solve_state.current = false;
+        skt->stats.step_norm = ff__norm2(step, cols);
+        tiny_steps = (skt->stats.step_norm <= FF_STEP_TINY * (1.0 + sqrt(xnorm))) ? tiny_steps + 1 : 0;
+
+        memcpy(fprev, fvec, sizeof(ff_float) * jac.rows);
+        fnorm_prev2 = fnorm_prev;
+        fnorm_prev = fnorm;
+        skt->stats.iterations++;
+
+        //out of time or cancelled: the iterate is kept, and a timed solve's next call goes on from it
+        if (ffSolveLimit__Reached(limit)) {
+            result = FF_SOLVE_PAUSED;
+            skt->paused.kept        = jac.rows;
+            skt->paused.refresh     = refresh;
+            skt->paused.stale       = stale;
+            skt->paused.reused      = reused;
+            skt->paused.n_broyden   = n_broyden;
+            skt->paused.eta         = eta;
+            skt->paused.fnorm_prev  = fnorm_prev;
+            skt->paused.fnorm_prev2 = fnorm_prev2;
+            skt->paused.fnorm_best  = fnorm_best;
+            skt->paused.flat        = flat;
+            skt->paused.since_best  = since_best;
+            skt->paused.tiny_steps  = tiny_steps;
+            break;
         }
 
-       printf("--==--==--==--\n\n\n");
+       FF_LOG("--==--==--==--\n\n\n");
 
     } //For step in maxsteps
 
-    
-    
+    //Dependent constraints hold at the solution (redundant) or not (conflicting)
+    if (jac.rows < rows) {
+        const bool all = ffSketch_calcError(skt, rows, tolerance);
+        if (result == FF_SOLVE_CONVERGED && !all) result = FF_SOLVE_CONFLICTING;
+        ffSketch__RecordDependent(skt, jac.rows, rows, tolerance);
+        ffSketch__RestoreRows(skt, rows);
+    }
+    skt->stats.result = result;
+
 
     //End of solving process.
     //TODO@ revert params here when failed
-    return converged;
+    return result == FF_SOLVE_CONVERGED;
+}
+
+// Linked systems of the sketch: its parts, or the sketch itself when it is
+// solved whole. Handing out a part makes it the one built-in backends act on.
+static inline uint16_t ffSketch__SystemCount(const ff_Sketch* skt) {
+    return skt->part_count ? skt->part_count : 1;
+}
+
+static inline ff_Sketch* ffSketch__System(ff_Sketch* skt, uint16_t k) {
+    if (!skt->part_count) return skt;
+    skt->active = &skt->parts[k];
+    return skt->active;
+}
+
+// Buffers of one worker of a split solve, by parameter slot: a block's
+// values before its solve and the upstream slots its rows use; and whether
+// the worker has solved anything yet in this call.
+typedef struct ff_SolveWork {
+    ff_float* start;
+    bool*     mark;
+    uint16_t* up;
+    bool      progressed;
+} ff_SolveWork;
+
+static void ffSolveWork__Init(ff_SolveWork* w, uint16_t pcap) {
+    w->start = malloc(sizeof(ff_float) * (pcap ? pcap : 1));
+    w->mark  = calloc(pcap ? pcap : 1, sizeof(bool));
+    w->up    = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    w->progressed = false;
+}
+
+static void ffSolveWork__Free(ff_SolveWork* w) {
+    free(w->start);
+    free(w->mark);
+    free(w->up);
+}
+
+// Solves the blocks of component k in order. A block sees the blocks before
+// it as constants, so solving them in order leaves every row solved; a block
+// that fails does not stop the ones after it from following as well as they
+// can. carry (by slot, shared) receives how far each solved parameter moved.
+// Only the component's own parts and slots are touched, so components may be
+// solved concurrently; the owner then does not route built-in backends.
+// The component goes on from where a paused solve left it, and pauses at the
+// block it is on once the limit is reached (see ffSketch_SolveTimed).
+static void ffSketch__SolveComponent(ff_Sketch* skt, uint16_t k, double tolerance, uint32_t max_steps,
+                                     ff_float* carry, ff_SolveWork* w, bool concurrent, const ff_SolveLimit* limit) {
+    const uint16_t first = skt->resume_block ? skt->resume_block[k] : skt->comp_ptr[k];
+    FF_LOG("Component %u: %u blocks\n", k, skt->comp_ptr[k + 1] - first);
+    for (uint16_t b = first; b < skt->comp_ptr[k + 1]; b++) {
+        ff_Sketch*     part = concurrent ? &skt->parts[b] : ffSketch__System(skt, b);
+        const uint32_t used = (skt->resume_block && b == first) ? skt->resume_steps[k] : 0;
+        if (w->progressed && ffSolveLimit__Reached(limit)) {
+            part->stats.result = FF_SOLVE_PAUSED;
+            if (skt->resume_block) {
+                skt->resume_block[k] = b;
+                skt->resume_steps[k] = used;
+            }
+            return;
+        }
+        part->config   = skt->config;
+        part->analyzed = NULL; //a custom backend holds the analysis of whichever part it saw last
+
+        //upstream parameters this block's rows use that have moved; a block
+        //going on from a paused iterate took them in when it started
+        uint16_t n_up = 0;
+        if (b > skt->comp_ptr[k] && !used) {
+            for (uint16_t r = 0; r < part->constraints.alive_count; r++)
+                ffExpr__CollectSlots(part->tmp_contraints[r]->def.eq, part, w->mark, w->up, &n_up);
+            uint16_t kept = 0;
+            for (uint16_t i = 0; i < n_up; i++) {
+                w->mark[w->up[i]] = false;
+                if (carry[w->up[i]] != 0.0 && isfinite(carry[w->up[i]])) w->up[kept++] = w->up[i];
+            }
+            n_up = kept;
+        }
+        const uint16_t cols = part->params.alive_count;
+        for (uint16_t c = 0; c < cols; c++) w->start[c] = part->tmp_params[c]->def.v;
+        ffSketch__SolveSystem(part, tolerance, used < max_steps ? max_steps - used : 0, carry, w->up, n_up, limit, used > 0);
+        part->stats.iterations += used;
+        w->progressed = true;
+        for (uint16_t c = 0; c < cols; c++)
+            carry[part->param_slot[c]] += part->tmp_params[c]->def.v - w->start[c];
+        if (part->stats.result == FF_SOLVE_PAUSED) {
+            if (skt->resume_block) {
+                skt->resume_block[k] = b;
+                skt->resume_steps[k] = part->stats.iterations;
+            }
+            return;
+        }
+    }
+    if (skt->resume_block) skt->resume_block[k] = skt->comp_ptr[k + 1];
+}
+
+// Below this many Jacobian nonzeros in all, starting workers costs more than
+// the components take.
+#define FF_PARALLEL_MIN_NNZ 4096
+
+#if FF_THREADS
+// Components handed out largest first from a shared cursor. They never spawn
+// work of their own, so an idle worker taking the next one off the list is
+// all the stealing there is to do.
+typedef struct ff_SolvePool {
+    ff_Sketch*      skt;
+    double          tolerance;
+    uint32_t        max_steps;
+    ff_float*       carry;
+    const ff_SolveLimit* limit;
+    const uint16_t* order;
+    uint32_t        next;
+    pthread_mutex_t lock;
+} ff_SolvePool;
+
+static void* ff__SolveWorker(void* arg) {
+    ff_SolvePool* pool = arg;
+    ff_SolveWork  w;
+    ffSolveWork__Init(&w, pool->skt->params.cap);
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        const uint32_t i = pool->next < pool->skt->comp_count ? pool->next++ : UINT32_MAX;
+        pthread_mutex_unlock(&pool->lock);
+        if (i == UINT32_MAX) break;
+        ffSketch__SolveComponent(pool->skt, pool->order[i], pool->tolerance, pool->max_steps, pool->carry, &w, true, pool->limit);
+    }
+    ffSolveWork__Free(&w);
+    return NULL;
+}
+
+// Size of a component (nonzeros plus rows) with its index, to order the work.
+typedef struct ff_ComponentCost {
+    uint64_t cost;
+    uint16_t comp;
+} ff_ComponentCost;
+
+static int ff__CompareComponentCost(const void* a, const void* b) {
+    const ff_ComponentCost* x = a;
+    const ff_ComponentCost* y = b;
+    if (x->cost != y->cost) return x->cost > y->cost ? -1 : 1;
+    return x->comp < y->comp ? -1 : x->comp > y->comp;
+}
+
+// Solves the components on up to config.threads workers, the calling thread
+// being one of them. False (nothing solved) if it is not worth it.
+static bool ffSketch__SolveParallel(ff_Sketch* skt, double tolerance, uint32_t max_steps, ff_float* carry, const ff_SolveLimit* limit) {
+    uint64_t nnz = 0;
+    for (uint16_t k = 0; k < skt->comp_count; k++) nnz += skt->comp_stats[k].nnz;
+    const uint16_t workers = skt->config.threads < skt->comp_count ? skt->config.threads : skt->comp_count;
+    if (workers < 2 || nnz < FF_PARALLEL_MIN_NNZ || skt->config.linear == FF_LINEAR_CUSTOM) return false;
+
+    ff_SolvePool pool = { .skt = skt, .tolerance = tolerance, .max_steps = max_steps, .carry = carry, .limit = limit, .next = 0 };
+    ff_ComponentCost* cost  = malloc(sizeof(ff_ComponentCost) * skt->comp_count);
+    uint16_t*         order = malloc(sizeof(uint16_t) * skt->comp_count);
+    for (uint16_t k = 0; k < skt->comp_count; k++) cost[k] = (ff_ComponentCost){ (uint64_t)skt->comp_stats[k].nnz + skt->comp_stats[k].rows, k };
+    qsort(cost, skt->comp_count, sizeof(ff_ComponentCost), ff__CompareComponentCost);
+    for (uint16_t k = 0; k < skt->comp_count; k++) order[k] = cost[k].comp;
+    free(cost);
+    pool.order = order;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    //a worker that fails to start only leaves more for the others
+    pthread_t* tid     = malloc(sizeof(pthread_t) * workers);
+    bool*      started = calloc(workers, sizeof(bool));
+    for (uint16_t t = 1; t < workers; t++) started[t] = pthread_create(&tid[t], NULL, ff__SolveWorker, &pool) == 0;
+    ff__SolveWorker(&pool);
+    for (uint16_t t = 1; t < workers; t++) if (started[t]) pthread_join(tid[t], NULL);
+
+    pthread_mutex_destroy(&pool.lock);
+    free(tid);
+    free(started);
+    free(order);
+    skt->active = NULL;
+    return true;
+}
+#endif
+
+// Solves the sketch until done or the limit (NULL = none) is reached. With a
+// deadline a paused solve goes on, and pauses again once time is up; without
+// one the solve starts over.
+static bool ffSketch__SolveUntil(ff_Sketch* skt, double tolerance, uint32_t max_steps, const ff_SolveLimit* limit) {
+    if (skt->job) return false; //the link is lent to a background solve
+
+    ffSketch_tryRelink(skt);
+
+    const bool resumable = limit && limit->deadline;
+    if (!resumable) ffSketch__DropResume(skt);
+    if (resumable && !skt->resume_block) {
+        const uint16_t comps = skt->part_count ? skt->comp_count : 1;
+        skt->resume_block = malloc(sizeof(uint16_t) * (comps ? comps : 1));
+        skt->resume_steps = calloc(comps ? comps : 1, sizeof(uint32_t));
+        skt->resume_carry = calloc(skt->params.cap ? skt->params.cap : 1, sizeof(ff_float));
+        for (uint16_t k = 0; k < comps; k++) skt->resume_block[k] = skt->part_count ? skt->comp_ptr[k] : 0;
+    }
+
+    if (!skt->part_count) {
+        const uint32_t used = skt->resume_steps ? skt->resume_steps[0] : 0;
+        ffSketch__SolveSystem(skt, tolerance, used < max_steps ? max_steps - used : 0, NULL, NULL, 0, limit, used > 0);
+        skt->stats.iterations += used;
+        if (skt->resume_steps) skt->resume_steps[0] = skt->stats.iterations;
+    } else {
+        //Components share no parameter: each one converges, stalls or fails on
+        //its own, and comes out the same whichever worker solves it
+        ff_float* carry = resumable ? skt->resume_carry : calloc(skt->params.cap ? skt->params.cap : 1, sizeof(ff_float));
+        bool      done  = false;
+#if FF_THREADS
+        done = ffSketch__SolveParallel(skt, tolerance, max_steps, carry, limit);
+#endif
+        if (!done) {
+            ff_SolveWork w;
+            ffSolveWork__Init(&w, skt->params.cap);
+            for (uint16_t k = 0; k < skt->comp_count; k++) ffSketch__SolveComponent(skt, k, tolerance, max_steps, carry, &w, false, limit);
+            ffSolveWork__Free(&w);
+        }
+        if (!resumable) free(carry);
+        ffSketch__GatherStats(skt);
+    }
+
+    if (skt->stats.result != FF_SOLVE_PAUSED) ffSketch__DropResume(skt);
+    return skt->stats.result == FF_SOLVE_CONVERGED;
+}
+
+bool ffSketch_Solve(ff_Sketch* skt, double tolerance, uint32_t max_steps) {
+    return ffSketch__SolveUntil(skt, tolerance, max_steps, NULL);
+}
+
+bool ffSketch_SolveTimed(ff_Sketch* skt, double tolerance, uint32_t max_steps, uint32_t budget_us) {
+    const ff_SolveLimit limit = { .deadline = ff__NowUs() + budget_us + 1 };
+    return ffSketch__SolveUntil(skt, tolerance, max_steps, &limit);
+}
+
+// A background solve works on a sketch of its own: the owner's link (parts,
+// factorizations, scratch) moved over onto copies of the parameter and
+// constraint tables. Nothing the solve writes is visible in the owner until
+// the link is handed back.
+struct ff_SolveJob {
+    ff_Sketch* skt;       //sketch the job belongs to
+    ff_Sketch  work;      //its link, on the job's own tables
+    double     tolerance;
+    uint32_t   max_steps;
+#if FF_THREADS
+    pthread_t       thread;
+    bool            threaded; //the solve runs on thread (else it ran in ffSketch_SolveAsync)
+    pthread_mutex_t lock;
+    bool            cancel;
+    bool            finished;
+#endif
+};
+
+// Points a sketch's link, whose packed rows and columns point into another
+// copy of its tables, at its own tables (same slots, other storage).
+static void ffSketch__Retable(ff_Sketch* skt) {
+    if (skt->tmp_params)
+        for (uint16_t c = 0; c < skt->params.alive_count; c++)
+            skt->tmp_params[c] = &skt->params.slots[skt->param_slot[c]].payload;
+    if (skt->tmp_contraints)
+        for (uint16_t r = 0; r < skt->constraints.alive_count; r++)
+            skt->tmp_contraints[r] = &skt->constraints.slots[skt->cons_slot[r]].payload;
+    for (uint16_t k = 0; k < skt->part_count; k++) {
+        skt->parts[k].owner = skt;
+        ffSketch__Rebase(&skt->parts[k], skt);
+    }
+}
+
+static void ffSketch__LendLink(ff_Sketch* skt, ff_Sketch* work) {
+    *work = *skt;
+    work->params.slots      = malloc(sizeof(*skt->params.slots) * (skt->params.cap ? skt->params.cap : 1));
+    work->constraints.slots = malloc(sizeof(*skt->constraints.slots) * (skt->constraints.cap ? skt->constraints.cap : 1));
+    memcpy(work->params.slots, skt->params.slots, sizeof(*skt->params.slots) * skt->params.cap);
+    memcpy(work->constraints.slots, skt->constraints.slots, sizeof(*skt->constraints.slots) * skt->constraints.cap);
+    ffSketch__Retable(work);
+}
+
+// Takes the link back as the solve left it. The owner keeps its tables,
+// config and analyses, which could be read (or set) meanwhile; with publish
+// the solved values are copied into the tables.
+static void ffSketch__ReturnLink(ff_Sketch* skt, ff_Sketch* work, bool publish) {
+    const ff_Sketch kept = *skt;
+    *skt = *work;
+    skt->params       = kept.params;
+    skt->entities     = kept.entities;
+    skt->constraints  = kept.constraints;
+    skt->config       = kept.config;
+    skt->dof_outdated = kept.dof_outdated;
+    skt->dof_cons     = kept.dof_cons;
+    skt->dof_param    = kept.dof_param;
+    skt->dof_total    = kept.dof_total;
+    skt->dof          = kept.dof;
+    skt->dof_comps    = kept.dof_comps;
+    skt->job          = NULL;
+    ffSketch__Retable(skt);
+
+    //the solve may have moved the packed rows (ffSketch__PermuteRows), and
+    //only the job's copies of the constraints followed them
+    if (skt->tmp_contraints) ffSketch__PointRows(skt);
+    for (uint16_t k = 0; k < skt->part_count; k++) ffSketch__PointRows(&skt->parts[k]);
+
+    if (publish) {
+        for (uint16_t p = 0; p < skt->params.cap; p++)
+            if (skt->params.slots[p].alive) skt->params.slots[p].payload.def.v = work->params.slots[p].payload.def.v;
+        for (uint16_t c = 0; c < skt->constraints.cap; c++)
+            if (skt->constraints.slots[c].alive) skt->constraints.slots[c].payload.JMR = work->constraints.slots[c].payload.JMR;
+    } else {
+        //the factorizations belong to iterates that were thrown away
+        skt->solve_state.factored = false;
+        for (uint16_t k = 0; k < skt->part_count; k++) skt->parts[k].solve_state.factored = false;
+        skt->stats.result = FF_SOLVE_CANCELLED;
+    }
+    free(work->params.slots);
+    free(work->constraints.slots);
+}
+
+static void* ff__SolveJobMain(void* arg) {
+    ff_SolveJob*  job   = arg;
+    ff_SolveLimit limit = { 0 };
+#if FF_THREADS
+    limit.lock   = &job->lock;
+    limit.cancel = &job->cancel;
+#endif
+    ffSketch__SolveUntil(&job->work, job->tolerance, job->max_steps, &limit);
+#if FF_THREADS
+    pthread_mutex_lock(&job->lock);
+    job->finished = true;
+    pthread_mutex_unlock(&job->lock);
+#endif
+    return NULL;
+}
+
+ff_SolveJob* ffSketch_SolveAsync(ff_Sketch* skt, double tolerance, uint32_t max_steps) {
+    if (skt->job || skt->owner) return NULL;
+    ffSketch_tryRelink(skt);
+    ffSketch__DropResume(skt);
+
+    ff_SolveJob* job = calloc(1, sizeof(ff_SolveJob));
+    job->skt       = skt;
+    job->tolerance = tolerance;
+    job->max_steps = max_steps;
+    ffSketch__LendLink(skt, &job->work);
+    skt->job = job;
+#if FF_THREADS
+    pthread_mutex_init(&job->lock, NULL);
+    job->threaded = pthread_create(&job->thread, NULL, ff__SolveJobMain, job) == 0;
+    if (!job->threaded) ff__SolveJobMain(job);
+#else
+    ff__SolveJobMain(job);
+#endif
+    return job;
+}
+
+// Hands the link back to the sketch and frees the job.
+static void ffSolveJob__Finish(ff_SolveJob* job, bool publish) {
+#if FF_THREADS
+    if (job->threaded) pthread_join(job->thread, NULL);
+    pthread_mutex_destroy(&job->lock);
+#endif
+    ffSketch__ReturnLink(job->skt, &job->work, publish);
+    free(job);
+}
+
+bool ffSolveJob_Done(ff_SolveJob* job) {
+#if FF_THREADS
+    pthread_mutex_lock(&job->lock);
+    const bool finished = job->finished;
+    pthread_mutex_unlock(&job->lock);
+    if (!finished) return false;
+#endif
+    ffSolveJob__Finish(job, true);
+    return true;
+}
+
+bool ffSolveJob_Wait(ff_SolveJob* job) {
+    ff_Sketch* skt = job->skt;
+    ffSolveJob__Finish(job, true);
+    return skt->stats.result == FF_SOLVE_CONVERGED;
+}
+
+void ffSolveJob_Cancel(ff_SolveJob* job) {
+#if FF_THREADS
+    pthread_mutex_lock(&job->lock);
+    job->cancel = true;
+    pthread_mutex_unlock(&job->lock);
+#endif
+    ffSolveJob__Finish(job, false);
+}
+
+uint16_t ffSketch_DependentConstraints(const ff_Sketch* skt, enum ff_Dependency kind, ff_ConstraintHandle* out, uint16_t cap) {
+    const bool conflicting = kind == FF_DEPENDENT_CONFLICTING;
+    uint16_t   n = 0;
+    for (uint16_t k = 0; k < ffSketch__SystemCount(skt); k++) {
+        const ff_Sketch* sys   = skt->part_count ? &skt->parts[k] : skt;
+        const uint16_t   first = conflicting ? sys->stats.redundant : 0;
+        const uint16_t   count = conflicting ? sys->stats.conflicting : sys->stats.redundant;
+        for (uint16_t i = 0; i < count; i++, n++) if (n < cap) out[n] = sys->dependent[first + i];
+    }
+    return n;
+}
+
+// Tolerance of the sensitivity solves for iterative backends; direct ones
+// ignore it.
+#define FF_SENSITIVITY_TOL 1e-10
+
+// Gets the packed rows back into the order of the last factorization (the
+// dependent rows of the last solve behind the others) and describes them in J.
+static void ffSketch__BeginReuse(ff_Sketch* skt, ff_JacobianView* J) {
+    const uint16_t rows = skt->constraints.alive_count;
+    const uint16_t kept = skt->solve_state.rows;
+    if (kept < rows) ffSketch__PermuteRows(skt, rows, skt->dependent_perm);
+    *J = ffSketch__JacView(skt, kept, skt->params.alive_count);
+    if (kept < rows) J->struct_rank = kept;
+}
+
+// Re-evaluates J (rows in the order of ffSketch__BeginReuse) at the
+// parameters' current values and refactors it with the backend of the last
+// solve. That solve ends on a step, so its factorization is of the iterate
+// before; a backend that now fails is replaced by the least-squares one.
+static void ffSketch__RefreshFactor(ff_Sketch* skt, const ff_JacobianView* J) {
+    for (uint16_t r = 0; r < J->rows; r++) {
+        ff_Constraint* cons = skt->tmp_contraints[r];
+        for (uint16_t p = 0; p < cons->JMR.dervs_cnt; p++) cons->JMR.dervs_y[p] = expr_evaluate(cons->JMR.dervs[p], &skt->params);
+    }
+    if (skt->config.equilibrate != FF_EQUIL_NONE) ffSketch__Equilibrate(skt, J->rows, J->cols);
+    const char*            why      = NULL;
+    const ff_LinearBackend fallback = ffSketch_BuiltinBackend(skt, ffSketch__PickLeastSquares(skt, &why));
+    const ff_LinearBackend primary  = skt->solve_state.backend;
+    uint16_t rank = 0;
+    skt->solve_state.backend = *ffSketch__FactorJacobian(&primary, &fallback, J, &rank);
+    skt->solve_state.current = true;
+    skt->paused.refresh      = true; //a paused solve's reused steps lose their scratch to the callers
+    (void)why;
+}
+
+static void ffSketch__EndReuse(ff_Sketch* skt) {
+    if (skt->solve_state.rows < skt->constraints.alive_count) ffSketch__RestoreRows(skt, skt->constraints.alive_count);
+}
+
+// Row of a driving constraint in the last factorization of a system, or
+// FF_INVALID_INDEX if the constraint is not in it: another system's, a stale
+// handle, set aside as dependent, or no factorization to reuse.
+static uint16_t ffSketch__DriverRow(const ff_Sketch* skt, ff_ConstraintHandle h) {
+    const ff_Constraint* cons = ffSketch_GetConstraint_Protected(skt, h);
+    if (!cons || !skt->solve_state.factored) return FF_INVALID_INDEX;
+    const bool moved = skt->solve_state.rows < skt->constraints.alive_count;
+    for (uint16_t k = 0; k < skt->solve_state.rows; k++)
+        if (skt->tmp_contraints[moved ? skt->dependent_perm[k] : k] == cons) return k;
+    return FF_INVALID_INDEX;
+}
+
+// Rows of the drivers in one system's last factorization (see
+// ffSketch__DriverRow); returns how many it has.
+static uint16_t ffSketch__DriverRows(const ff_Sketch* sys, const ff_ConstraintHandle* drivers, uint16_t n, uint16_t* rows) {
+    uint16_t found = 0;
+    for (uint16_t d = 0; d < n; d++) {
+        rows[d] = ffSketch__DriverRow(sys, drivers[d]);
+        if (rows[d] != FF_INVALID_INDEX) found++;
+    }
+    return found;
+}
+
+// One forward pass of the first-order change over systems first..end-1 of a
+// component, in solve order: each system solves J dx = shift - (change of its
+// rows caused by the systems before it), and dx goes into v (by parameter
+// slot, zero on entry). Shifts are applied on the drivers' rows; a system
+// with nothing to do is skipped. False if one that has to move was never
+// factored.
+static bool ffSketch__Propagate(ff_Sketch* skt, uint16_t first, uint16_t end, const ff_ConstraintHandle* drivers,
+                                const ff_float* shifts, uint16_t n, uint16_t* drow, ff_float* v) {
+    bool moved = false;
+    for (uint16_t s = first; s < end; s++) {
+        ff_Sketch*     sys   = ffSketch__System(skt, s);
+        const uint16_t rows  = sys->constraints.alive_count;
+        const uint16_t cols  = sys->params.alive_count;
+        bool           any   = ffSketch__DriverRows(sys, drivers, n, drow) != 0;
+
+        //same scratch regions as a Newton step: step | work | rhs ... | scaled rhs;
+        //the coupling is taken in relink row order, before the rows are permuted
+        ff_float* b   = ffSketch__Work(sys, cols) + 2 * (size_t)rows + 4 * (size_t)cols;
+        ff_float* bs  = b + 2 * (size_t)rows + cols;
+        for (uint16_t r = 0; r < rows; r++) {
+            ff_float dv = 0.0;
+            if (moved) ffExpr__Directional(sys->tmp_contraints[r]->def.eq, &sys->params, v, &dv);
+            bs[r] = -dv;
+            any = any || dv != 0.0;
+        }
+        if (!any) continue;
+        if (!sys->solve_state.factored) return false;
+
+        ff_JacobianView J;
+        const bool permuted = sys->solve_state.rows < rows;
+        ffSketch__BeginReuse(sys, &J);
+        if (!sys->solve_state.current) ffSketch__RefreshFactor(sys, &J);
+        for (uint16_t r = 0; r < J.rows; r++) b[r] = bs[permuted ? sys->dependent_perm[r] : r];
+        for (uint16_t d = 0; d < n; d++) if (drow[d] != FF_INVALID_INDEX) b[drow[d]] += shifts[d];
+        ffSketch__ScaledSolve(sys, &sys->solve_state.backend, &J, b, FF_SENSITIVITY_TOL, sys->scratch, bs);
+        for (uint16_t c = 0; c < J.cols; c++) v[sys->param_slot[c]] = sys->scratch[c];
+        ffSketch__EndReuse(sys);
+        moved = true;
+    }
+    return true;
+}
+
+bool ffSketch_Sensitivity(ff_Sketch* skt, const ff_ConstraintHandle* drivers, uint16_t n_drivers,
+                          const ff_ParamHandle* params, uint16_t n_params, ff_float* dxdp) {
+    if (skt->link_outdated || skt->job) return false;
+    for (size_t i = 0; i < (size_t)n_drivers * n_params; i++) dxdp[i] = 0.0;
+
+    //a driver moves its own block and, through the coupling, the blocks after
+    //it in its component; other components do not see it
+    bool      ok   = true;
+    uint16_t  drow = 0;
+    ff_float* v    = malloc(sizeof(ff_float) * (skt->params.cap ? skt->params.cap : 1));
+    const ff_float one = 1.0;
+    for (uint16_t k = 0; k < n_params; k++) if (!ffSketch_GetParameter_Protected(skt, params[k])) ok = false;
+    for (uint16_t d = 0; d < n_drivers && ok; d++) {
+        if (!ffSketch_GetConstraint_Protected(skt, drivers[d])) { ok = false; break; }
+        const uint16_t comp  = skt->cons_part[drivers[d].idx];
+        const uint16_t first = skt->part_count ? skt->comp_ptr[comp] : 0;
+        const uint16_t end   = skt->part_count ? skt->comp_ptr[comp + 1] : 1;
+        uint16_t s = first;
+        while (s < end && ffSketch__DriverRow(ffSketch__System(skt, s), drivers[d]) == FF_INVALID_INDEX) s++;
+        if (s == end) { ok = false; break; }
+
+        //J dx = e_row: the step that moves this residual by one and holds the others
+        memset(v, 0, sizeof(ff_float) * skt->params.cap);
+        if (!ffSketch__Propagate(skt, s, end, &drivers[d], &one, 1, &drow, v)) { ok = false; break; }
+        ff_float* out = dxdp + (size_t)d * n_params;
+        for (uint16_t k = 0; k < n_params; k++) out[k] = v[params[k].idx];
+    }
+    free(v);
+    return ok;
+}
+
+bool ffSketch_Predict(ff_Sketch* skt, const ff_ConstraintHandle* drivers, const ff_float* deltas, uint16_t n) {
+    if (skt->link_outdated || skt->job) return false;
+    uint16_t  found = 0;
+    uint16_t* drow  = malloc(sizeof(uint16_t) * (n ? n : 1));
+    for (uint16_t s = 0; s < ffSketch__SystemCount(skt); s++) found += ffSketch__DriverRows(ffSketch__System(skt, s), drivers, n, drow);
+    ff_float* v  = calloc(skt->params.cap ? skt->params.cap : 1, sizeof(ff_float));
+    //one pass per component for all of them: the first-order change is linear
+    //in the shifts. Parameters move only at the end, so every block is
+    //linearized at the point the solve left
+    bool ok = found == n;
+    if (!skt->part_count) ok = ok && ffSketch__Propagate(skt, 0, 1, drivers, deltas, n, drow, v);
+    for (uint16_t k = 0; k < skt->comp_count && ok; k++) ok = ffSketch__Propagate(skt, skt->comp_ptr[k], skt->comp_ptr[k + 1], drivers, deltas, n, drow, v);
+    if (ok) {
+        for (uint16_t p = 0; p < skt->params.cap; p++) if (v[p] != 0.0) skt->params.slots[p].payload.def.v += v[p];
+        for (uint16_t s = 0; s < ffSketch__SystemCount(skt); s++) ffSketch__System(skt, s)->solve_state.current = false;
+    }
+    free(drow);
+    free(v);
+    return ok;
+}
+
+bool ffSketch_BeginDrag(ff_Sketch* skt, const ff_ParamHandle* params, uint16_t n) {
+    if (skt->drag || skt->job || !n) return false;
+    for (uint16_t i = 0; i < n; i++) if (!ffSketch_GetParameter_Protected(skt, params[i])) return false;
+
+    skt->drag       = malloc(sizeof(ff_ConstraintHandle) * n);
+    skt->drag_to    = malloc(sizeof(ff_Expr*) * n);
+    skt->drag_count = n;
+    for (uint16_t i = 0; i < n; i++) {
+        ff_ConstraintDef def = ff_ConstraintDef_DEFAULT();
+        skt->drag_to[i] = exprInit_const(ffSketch_GetParameter(skt, params[i])->def.v);
+        def.eq          = exprInit_op(OperatorType_SUB, exprInit_param(params[i]), skt->drag_to[i]);
+        skt->drag[i]    = ffSketch_AddConstraint(skt, def);
+    }
+    return true;
 }
 
+bool ffSketch_Drag(ff_Sketch* skt, const ff_float* targets, double tolerance, uint32_t max_steps) {
+    if (!skt->drag || skt->job) return false;
+
+    //moving a target changes no derivative and no pattern, so the link and
+    //the last frame's factorization stay valid for the prediction; there is
+    //none on the first frame, or after the last one ended without factoring
+    ff_float* deltas = malloc(sizeof(ff_float) * skt->drag_count);
+    for (uint16_t i = 0; i < skt->drag_count; i++) deltas[i] = targets[i] - skt->drag_to[i]->value;
+    ffSketch_Predict(skt, skt->drag, deltas, skt->drag_count);
+    for (uint16_t i = 0; i < skt->drag_count; i++) skt->drag_to[i]->value = targets[i];
+    free(deltas);
+
+    return ffSketch_Solve(skt, tolerance, max_steps);
+}
+
+void ffSketch_EndDrag(ff_Sketch* skt) {
+    if (skt->job) return; //its constraints are being solved
+    for (uint16_t i = 0; i < skt->drag_count; i++) {
+        ff_Constraint* cons = ffSketch_GetConstraint(skt, skt->drag[i]);
+        if (!cons) continue; //deleted during the drag
+        ff_Expr* eq = cons->def.eq;
+        ffSketch_DeleteConstraint(skt, skt->drag[i]);
+        expr_free(eq);
+    }
+    free(skt->drag);
+    free(skt->drag_to);
+    skt->drag       = NULL;
+    skt->drag_to    = NULL;
+    skt->drag_count = 0;
+}
+
+uint16_t ffSketch_ComponentCount(ff_Sketch* skt) {
+    ffSketch_tryRelink(skt);
+    return skt->part_count ? skt->comp_count : skt->stats.components;
+}
+
+const ff_SolveStats* ffSketch_ComponentStats(const ff_Sketch* skt, uint16_t component) {
+    if (skt->part_count) return component < skt->comp_count ? &skt->comp_stats[component] : NULL;
+    return component < skt->stats.components ? &skt->stats : NULL;
+}
+
+uint16_t ffSketch_ConstraintComponent(ff_Sketch* skt, ff_ConstraintHandle h) {
+    if (!ffSketch_GetConstraint_Protected(skt, h)) return FF_INVALID_INDEX;
+    ffSketch_tryRelink(skt);
+    return skt->cons_part[h.idx];
+}
+
+uint16_t ffSketch_ParameterComponent(ff_Sketch* skt, ff_ParamHandle h) {
+    if (!ffSketch_GetParameter_Protected(skt, h)) return FF_INVALID_INDEX;
+    ffSketch_tryRelink(skt);
+    return skt->param_part[h.idx];
+}
+
+// Structural analysis behind the DOF queries: the Dulmage-Mendelsohn side
+// of every constraint and parameter, from the pattern alone (no relink, no
+// derivatives). Redone only after an edit. With the link outdated, the
+// components are found on the same pattern and their DOF counted in the
+// numbering a full relink gives them.
+static void ffSketch__AnalyzeDof(ff_Sketch* skt) {
+    if (!skt->dof_outdated) return;
+    skt->dof_outdated = false;
+
+    const uint16_t ccap = skt->constraints.cap, pcap = skt->params.cap;
+    free(skt->dof_cons);
+    free(skt->dof_param);
+    free(skt->dof);
+    skt->dof_cons  = malloc(ccap ? ccap : 1);
+    skt->dof_param = malloc(pcap ? pcap : 1);
+    skt->dof       = NULL;
+    skt->dof_comps = 0;
+    skt->dof_total = 0;
+
+    ff_SlotPattern pat;
+    ffSketch__SlotPattern(skt, NULL, 0, &pat);
+    uint16_t* row_match = malloc(sizeof(uint16_t) * (pat.rows ? pat.rows : 1));
+    uint16_t* col_match = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+    uint8_t*  row_kind  = malloc(pat.rows ? pat.rows : 1);
+    ff__DmSides(&pat, pcap, row_match, col_match, row_kind, skt->dof_param);
+    memset(skt->dof_cons, FF_DM_SQUARE, ccap);
+    for (uint16_t r = 0; r < pat.rows; r++) skt->dof_cons[pat.row_slot[r]] = row_kind[r];
+
+    //each matched parameter is fixed by its constraint, the others are left over
+    for (uint16_t p = 0; p < pcap; p++) {
+        if (!skt->params.slots[p].alive || col_match[p] != FF_INVALID_INDEX) continue;
+        skt->dof_param[p] = FF_DM_UNMATCHED;
+        skt->dof_total++;
+    }
+
+    if (skt->link_outdated || !skt->param_part) {
+        uint16_t* cons_comp  = malloc(sizeof(uint16_t) * (ccap ? ccap : 1));
+        uint16_t* param_comp = malloc(sizeof(uint16_t) * (pcap ? pcap : 1));
+        for (uint16_t p = 0; p < pcap; p++) param_comp[p] = FF_INVALID_INDEX;
+        const uint16_t comps = ffSketch__FindComponents(skt, &pat, cons_comp, param_comp);
+        //solved whole, the sketch is one component
+        skt->dof_comps = skt->config.decompose ? comps : (comps ? 1 : 0);
+        skt->dof       = calloc(skt->dof_comps ? skt->dof_comps : 1, sizeof(uint16_t));
+        for (uint16_t p = 0; p < pcap; p++)
+            if (skt->dof_param[p] == FF_DM_UNMATCHED && param_comp[p] != FF_INVALID_INDEX)
+                skt->dof[skt->config.decompose ? param_comp[p] : 0]++;
+        free(cons_comp);
+        free(param_comp);
+    }
+
+    ffSlotPattern__Free(&pat);
+    free(row_match);
+    free(col_match);
+    free(row_kind);
+}
+
+uint16_t ffSketch_DegreesOfFreedom(ff_Sketch* skt, uint16_t component) {
+    ffSketch__AnalyzeDof(skt);
+    if (component == FF_INVALID_INDEX) return skt->dof_total;
+    //the link is current here (a relink drops the counts): count in its
+    //numbering, which an incremental relink does not keep in slot order
+    if (!skt->dof) {
+        skt->dof_comps = skt->part_count ? skt->comp_count : skt->stats.components;
+        skt->dof       = calloc(skt->dof_comps ? skt->dof_comps : 1, sizeof(uint16_t));
+        for (uint16_t p = 0; p < skt->params.cap; p++)
+            if (skt->params.slots[p].alive && skt->dof_param[p] == FF_DM_UNMATCHED && skt->param_part[p] < skt->dof_comps) skt->dof[skt->param_part[p]]++;
+    }
+    return component < skt->dof_comps ? skt->dof[component] : 0;
+}
+
+uint16_t ffSketch_FreeParameters(ff_Sketch* skt, ff_ParamHandle* out, uint16_t cap) {
+    ffSketch__AnalyzeDof(skt);
+    uint16_t n = 0;
+    for (uint16_t p = 0; p < skt->params.cap; p++) {
+        if (!skt->params.slots[p].alive || (skt->dof_param[p] != FF_DM_UNDER && skt->dof_param[p] != FF_DM_UNMATCHED)) continue;
+        if (n < cap) out[n] = (ff_ParamHandle){ .idx = p, .gen = skt->params.slots[p].gen };
+        n++;
+    }
+    return n;
+}
+
+uint16_t ffSketch_OverdeterminingConstraints(ff_Sketch* skt, ff_ConstraintHandle* out, uint16_t cap) {
+    ffSketch__AnalyzeDof(skt);
+    uint16_t n = 0;
+    for (uint16_t c = 0; c < skt->constraints.cap; c++) {
+        if (!skt->constraints.slots[c].alive || skt->dof_cons[c] != FF_DM_OVER) continue;
+        if (n < cap) out[n] = (ff_ConstraintHandle){ .idx = c, .gen = skt->constraints.slots[c].gen };
+        n++;
+    }
+    return n;
+}
 
 
 
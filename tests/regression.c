@@ -0,0 +1,918 @@
+// Regression tests for free_form. Build and run from the repository root:
+//   cc -I. tests/regression.c -o regression -lm -pthread && ./regression
+// Each test prints its name; the program returns non-zero if any check fails.
+
+#define FF_FREEFORM_IMPL_
+#include "freeform.h"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                       \
+    do {                                                                  \
+        if (!(cond)) {                                                    \
+            printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                   \
+        }                                                                 \
+    } while (0)
+
+static ff_ParamHandle AddParam(ff_Sketch* skt, ff_float v) {
+    ff_ParameterDef def = ff_ParameterDef_DEFAULT();
+    def.v = v;
+    return ffSketch_AddParameter(skt, def);
+}
+
+static ff_ConstraintHandle AddEq(ff_Sketch* skt, ff_Expr* eq) {
+    ff_ConstraintDef def = ff_ConstraintDef_DEFAULT();
+    def.eq = eq;
+    return ffSketch_AddConstraint(skt, def);
+}
+
+static ff_float Value(ff_Sketch* skt, ff_ParamHandle h) {
+    return ffSketch_GetParameter(skt, h)->def.v;
+}
+
+// p - v
+static ff_Expr* Fix(ff_ParamHandle p, ff_float v) {
+    return exprInit_op(OperatorType_SUB, exprInit_param(p), exprInit_const(v));
+}
+
+// (x1 - x0)^2 + (y1 - y0)^2 - d^2
+static ff_Expr* Dist(ff_ParamHandle x0, ff_ParamHandle y0, ff_ParamHandle x1, ff_ParamHandle y1, ff_float d) {
+    ff_Expr* dx = exprInit_op(OperatorType_SQR, exprInit_op(OperatorType_SUB, exprInit_param(x1), exprInit_param(x0)), NULL);
+    ff_Expr* dy = exprInit_op(OperatorType_SQR, exprInit_op(OperatorType_SUB, exprInit_param(y1), exprInit_param(y0)), NULL);
+    return exprInit_op(OperatorType_SUB, exprInit_op(OperatorType_ADD, dx, dy), exprInit_const(d * d));
+}
+
+// A chain of n points at unit spacing with its first point pinned, started
+// on a zigzag so no link is degenerate. x and y receive the handles.
+static void AddChain(ff_Sketch* skt, uint32_t n, ff_ParamHandle* x, ff_ParamHandle* y) {
+    for (uint32_t i = 0; i < n; i++) {
+        x[i] = AddParam(skt, 0.9 * i);
+        y[i] = AddParam(skt, (i % 2) ? 0.4 : 0.0);
+    }
+    AddEq(skt, Fix(x[0], 0.0));
+    AddEq(skt, Fix(y[0], 0.0));
+    for (uint32_t i = 1; i < n; i++) AddEq(skt, Dist(x[i - 1], y[i - 1], x[i], y[i], 1.0));
+}
+
+// A chain of n points at unit spacing with its first point pinned, started
+// on a gentle wave so every point has to move.
+static void AddWavyChain(ff_Sketch* skt, uint32_t n, ff_ParamHandle* x, ff_ParamHandle* y) {
+    for (uint32_t i = 0; i < n; i++) {
+        x[i] = AddParam(skt, i);
+        y[i] = AddParam(skt, 0.3 * sin((double)i));
+    }
+    AddEq(skt, Fix(x[0], 0.0));
+    AddEq(skt, Fix(y[0], 0.0));
+    for (uint32_t i = 1; i < n; i++) AddEq(skt, Dist(x[i - 1], y[i - 1], x[i], y[i], 1.0));
+}
+
+// A well-constrained chain: every point's x is fixed at 0.8 * i and the links
+// have unit length, so the solution climbs by 0.6 per point (y[i] = 0.6 * i
+// from this start). 2n parameters, 2n constraints.
+static void AddSquareChain(ff_Sketch* skt, uint32_t n, ff_ParamHandle* x, ff_ParamHandle* y) {
+    for (uint32_t i = 0; i < n; i++) {
+        x[i] = AddParam(skt, 0.8 * i);
+        y[i] = AddParam(skt, 0.55 * i);
+        AddEq(skt, Fix(x[i], 0.8 * i));
+    }
+    AddEq(skt, Fix(y[0], 0.0));
+    for (uint32_t i = 1; i < n; i++) AddEq(skt, Dist(x[i - 1], y[i - 1], x[i], y[i], 1.0));
+}
+
+// Largest |y[i] - 0.6 * i| of a solved square chain
+static ff_float SquareChainError(ff_Sketch* skt, uint32_t n, const ff_ParamHandle* y) {
+    ff_float worst = 0.0;
+    for (uint32_t i = 0; i < n; i++) {
+        const ff_float e = fabs(Value(skt, y[i]) - 0.6 * i);
+        if (e > worst) worst = e;
+    }
+    return worst;
+}
+
+// Largest |link length - 1| of a chain
+static ff_float ChainError(ff_Sketch* skt, uint32_t n, const ff_ParamHandle* x, const ff_ParamHandle* y) {
+    ff_float worst = 0.0;
+    for (uint32_t i = 1; i < n; i++) {
+        const ff_float dx = Value(skt, x[i]) - Value(skt, x[i - 1]);
+        const ff_float dy = Value(skt, y[i]) - Value(skt, y[i - 1]);
+        const ff_float e  = fabs(sqrt(dx * dx + dy * dy) - 1.0);
+        if (e > worst) worst = e;
+    }
+    return worst;
+}
+
+// The dense backend works in J*J^T for under-constrained systems and in
+// J^T*J once consistent constraints outnumber the parameters.
+static void Test_NormalForm(void) {
+    enum { N = 20 };
+    ff_ParamHandle x[N], y[N];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 64, 8, 64);
+    skt.config.linear    = FF_LINEAR_DENSE;
+    skt.config.decompose = false;
+    AddWavyChain(&skt, N, x, y);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.solve_state.form == FF_NORMAL_JJT);
+    CHECK(ChainError(&skt, N, x, y) < 1e-8);
+    ffSketch_Free(&skt);
+
+    //the square chain plus a copy of every link: more rows than columns
+    ffSketch_Init(&skt, 64, 8, 128);
+    skt.config.linear           = FF_LINEAR_DENSE;
+    skt.config.decompose        = false;
+    skt.config.detect_dependent = false;
+    AddSquareChain(&skt, N, x, y);
+    for (uint32_t i = 1; i < N; i++) AddEq(&skt, Dist(x[i - 1], y[i - 1], x[i], y[i], 1.0));
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.solve_state.form == FF_NORMAL_JTJ);
+    CHECK(SquareChainError(&skt, N, y) < 1e-8);
+    ffSketch_Free(&skt);
+}
+
+// LSQR (with its default Jacobi preconditioner) takes the same minimum-norm
+// steps as the dense backend, so an under-constrained chain ends in the same place.
+static void Test_LSQRMinimumNorm(void) {
+    enum { N = 30 };
+    ff_ParamHandle x[N], y[N];
+    ff_float end[2][2];
+    const enum ff_LinearMethod methods[2] = { FF_LINEAR_DENSE, FF_LINEAR_LSQR };
+    for (int m = 0; m < 2; m++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 64, 8, 64);
+        skt.config.linear      = methods[m];
+        skt.config.forcing_max = 1e-12; //solve each step fully so only the metric differs
+        AddWavyChain(&skt, N, x, y);
+        CHECK(ffSketch_Solve(&skt, 1e-11, 50));
+        CHECK(strcmp(skt.stats.backend, m ? "lsqr" : "dense") == 0);
+        CHECK(ChainError(&skt, N, x, y) < 1e-8);
+        end[m][0] = Value(&skt, x[N - 1]);
+        end[m][1] = Value(&skt, y[N - 1]);
+        ffSketch_Free(&skt);
+    }
+    CHECK(fabs(end[0][0] - end[1][0]) < 1e-7);
+    CHECK(fabs(end[0][1] - end[1][1]) < 1e-7);
+}
+
+// A square, structurally nonsingular system goes to the sparse LU of J itself.
+static void Test_SquareLU(void) {
+    enum { N = 20 };
+    ff_ParamHandle x[N], y[N];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 64, 8, 64);
+    skt.config.decompose = false;
+    AddSquareChain(&skt, N, x, y);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.stats.normal_dim > FF_SMALL_MAX);
+    CHECK(skt.stats.method == FF_LINEAR_LU);
+    CHECK(strcmp(skt.stats.backend, "lu") == 0);
+    CHECK(SquareChainError(&skt, N, y) < 1e-8);
+    ffSketch_Free(&skt);
+}
+
+// The blocked dense Cholesky (normal matrices wider than one panel) agrees
+// with the sparse LU on a square system with a unique solution.
+static void Test_DenseBlocked(void) {
+    enum { N = 80 };
+    ff_ParamHandle x[N], y[N];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 256, 8, 256);
+    skt.config.linear    = FF_LINEAR_DENSE;
+    skt.config.decompose = false;
+    AddSquareChain(&skt, N, x, y);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.stats.normal_dim > FF_DENSE_NB);
+    CHECK(strcmp(skt.stats.backend, "dense") == 0);
+    CHECK(SquareChainError(&skt, N, y) < 1e-8);
+    ffSketch_Free(&skt);
+}
+
+// Chord and Broyden steps reuse the factorization yet reach the same solution
+// as full Newton.
+static void Test_JacobianReuse(void) {
+    enum { N = 20 };
+    const enum ff_JacobianUpdate updates[3] = { FF_JACOBIAN_EXACT, FF_JACOBIAN_CHORD, FF_JACOBIAN_BROYDEN };
+    ff_ParamHandle x[N], y[N];
+    for (int u = 0; u < 3; u++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 64, 8, 64);
+        skt.config.decompose       = false;
+        skt.config.jacobian_update = updates[u];
+        AddSquareChain(&skt, N, x, y);
+        CHECK(ffSketch_Solve(&skt, 1e-10, 100));
+        CHECK(SquareChainError(&skt, N, y) < 1e-8);
+        ffSketch_Free(&skt);
+    }
+}
+
+// A single-precision factorization refined against the double normal matrix
+// converges to the double-precision answer.
+static void Test_MixedPrecision(void) {
+    enum { N = 40 };
+    ff_ParamHandle x[N], y[N];
+    ff_float end[2];
+    for (int mixed = 0; mixed < 2; mixed++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 128, 8, 128);
+        skt.config.linear    = FF_LINEAR_DENSE;
+        skt.config.decompose = false;
+        skt.config.precision = mixed ? FF_PRECISION_MIXED : FF_PRECISION_DOUBLE;
+        AddWavyChain(&skt, N, x, y);
+        CHECK(ffSketch_Solve(&skt, 1e-11, 50));
+        CHECK(ChainError(&skt, N, x, y) < 1e-9);
+        CHECK(!mixed || skt.normal_f != NULL); //the float factor was used
+        end[mixed] = Value(&skt, y[N - 1]);
+        ffSketch_Free(&skt);
+    }
+    CHECK(fabs(end[0] - end[1]) < 1e-7);
+}
+
+// A custom backend that counts its calls and delegates to the built-in LU
+typedef struct CountingBackend {
+    ff_LinearBackend inner;
+    bool             accept;
+    uint32_t         analyzed, factored, solved;
+} CountingBackend;
+
+static bool Counting_Analyze(void* user, const ff_JacobianView* J) {
+    CountingBackend* cb = user;
+    cb->analyzed++;
+    return cb->accept && (!cb->inner.analyze || cb->inner.analyze(cb->inner.user, J));
+}
+static bool Counting_Factor(void* user, const ff_JacobianView* J, uint16_t* rank) {
+    CountingBackend* cb = user;
+    cb->factored++;
+    return cb->inner.factor(cb->inner.user, J, rank);
+}
+static void Counting_Solve(void* user, const ff_JacobianView* J, const ff_float* b, ff_float tol, ff_float* dx) {
+    CountingBackend* cb = user;
+    cb->solved++;
+    cb->inner.solve(cb->inner.user, J, b, tol, dx);
+}
+
+// FF_LINEAR_CUSTOM routes every step through config.backend, analyzes each
+// pattern once, and falls back to a built-in backend when analyze refuses.
+static void Test_CustomBackend(void) {
+    enum { N = 20 };
+    ff_ParamHandle x[N], y[N];
+    for (int accept = 1; accept >= 0; accept--) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 64, 8, 64);
+        CountingBackend cb = { ffSketch_BuiltinBackend(&skt, FF_LINEAR_LU), accept != 0, 0, 0, 0 };
+        const ff_LinearBackend custom = { "counting", &cb, Counting_Analyze, Counting_Factor, Counting_Solve };
+        skt.config.decompose = false;
+        skt.config.linear    = FF_LINEAR_CUSTOM;
+        skt.config.backend   = &custom;
+        AddSquareChain(&skt, N, x, y);
+        CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+        CHECK(SquareChainError(&skt, N, y) < 1e-8);
+        CHECK(cb.analyzed == 1);
+        if (accept) {
+            CHECK(strcmp(skt.stats.backend, "counting") == 0);
+            CHECK(cb.factored > 0 && cb.solved >= cb.factored);
+
+            //a second solve with the same pattern is not analyzed again
+            ffSketch_GetParameter(&skt, y[N - 1])->def.v += 0.1;
+            CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+            CHECK(cb.analyzed == 1);
+        } else {
+            CHECK(strcmp(skt.stats.backend, "counting") != 0);
+            CHECK(cb.factored == 0 && cb.solved == 0);
+        }
+        ffSketch_Free(&skt);
+    }
+}
+
+// FF_LINEAR_AUTO measures the system at relink and never builds a normal
+// matrix larger than dense_max_rows densely; it says why it chose.
+static void Test_AutoSelection(void) {
+    enum { N = 120 };
+    ff_ParamHandle x[N], y[N];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 256, 8, 256);
+    skt.config.decompose      = false;
+    skt.config.dense_max_rows = 60;
+    AddWavyChain(&skt, N, x, y);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ChainError(&skt, N, x, y) < 1e-8);
+    CHECK(skt.stats.rows == N + 1 && skt.stats.cols == 2 * N);
+    CHECK(skt.stats.normal_dim > skt.config.dense_max_rows);
+    CHECK(skt.stats.method == FF_LINEAR_BANDED || skt.stats.method == FF_LINEAR_LSQR);
+    CHECK(skt.stats.reason != NULL);
+    CHECK(skt.stats.band_cost > 0.0 && skt.stats.lsqr_cost > 0.0);
+    ffSketch_Free(&skt);
+
+    //a tiny system stays on the fixed-size kernels
+    ffSketch_Init(&skt, 64, 8, 64);
+    skt.config.decompose = false;
+    AddWavyChain(&skt, 4, x, y);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.stats.method == FF_LINEAR_SMALL);
+    ffSketch_Free(&skt);
+}
+
+// FF_LINEAR_SMALL set explicitly on more than FF_SMALL_MAX unknowns falls back
+// to a least-squares backend and says so in the stats.
+static void Test_SmallFallback(void) {
+    enum { N = 20 };
+    ff_ParamHandle x[N], y[N];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 64, 8, 64);
+    skt.config.linear = FF_LINEAR_SMALL;
+    AddChain(&skt, N, x, y);
+
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.stats.normal_dim > FF_SMALL_MAX);
+    CHECK(skt.stats.method != FF_LINEAR_SMALL);
+    CHECK(strcmp(skt.stats.backend, "small") != 0);
+    CHECK(strstr(skt.stats.reason, "fallback") != NULL);
+    CHECK(ChainError(&skt, N, x, y) < 1e-8);
+    ffSketch_Free(&skt);
+
+    //within the limit it is used as asked
+    ffSketch_Init(&skt, 64, 8, 64);
+    skt.config.linear = FF_LINEAR_SMALL;
+    AddChain(&skt, 4, x, y);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.stats.method == FF_LINEAR_SMALL);
+    CHECK(strcmp(skt.stats.backend, "small") == 0);
+    ffSketch_Free(&skt);
+}
+
+// Reverse Cuthill-McKee turns a chain built in scrambled order into a narrow
+// band, and the banded backend then reaches the dense backend's solution.
+static void Test_BandReorder(void) {
+    enum { N = 60 };
+    ff_ParamHandle x[N], y[N];
+    ff_float end[2], band[2];
+    for (int reorder = 0; reorder < 2; reorder++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 128, 8, 128);
+        skt.config.decompose = false;
+        skt.config.reorder   = reorder != 0;
+        skt.config.linear    = reorder ? FF_LINEAR_BANDED : FF_LINEAR_DENSE;
+        //points created in a scrambled order (37 is coprime with N)
+        for (uint32_t k = 0; k < N; k++) {
+            const uint32_t i = (k * 37) % N;
+            x[i] = AddParam(&skt, i);
+            y[i] = AddParam(&skt, 0.3 * sin((double)i));
+        }
+        AddEq(&skt, Fix(x[0], 0.0));
+        AddEq(&skt, Fix(y[0], 0.0));
+        for (uint32_t k = 1; k < N; k++) {
+            const uint32_t i = 1 + (k * 37) % (N - 1);
+            AddEq(&skt, Dist(x[i - 1], y[i - 1], x[i], y[i], 1.0));
+        }
+        CHECK(ffSketch_Solve(&skt, 1e-11, 50));
+        CHECK(ChainError(&skt, N, x, y) < 1e-9);
+        band[reorder] = skt.stats.normal_band;
+        end[reorder]  = Value(&skt, y[N - 1]);
+        if (reorder) CHECK(strcmp(skt.stats.backend, "band") == 0);
+        ffSketch_Free(&skt);
+    }
+    CHECK(band[1] <= 4 && band[0] > 4 * band[1]);
+    CHECK(fabs(end[0] - end[1]) < 1e-7);
+}
+
+// Replacing a constraint by another on the same parameters keeps the
+// symbolic analysis cached under the pattern's hash; a new pattern does not.
+static void Test_PatternCache(void) {
+    enum { N = 20 };
+    ff_ParamHandle x[N], y[N];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 64, 8, 64);
+    skt.config.decompose = false;
+    AddSquareChain(&skt, N, x, y);
+    const ff_ParamHandle z = AddParam(&skt, 0.0);
+    const ff_ConstraintHandle h = AddEq(&skt, Fix(z, 1.0));
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(!skt.stats.pattern_reused);
+
+    CHECK(ffSketch_DeleteConstraint(&skt, h));
+    AddEq(&skt, Fix(z, 2.0));
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(skt.stats.pattern_reused);
+    CHECK(strcmp(skt.stats.backend, "lu") == 0);
+    CHECK(fabs(Value(&skt, z) - 2.0) < 1e-10);
+    CHECK(SquareChainError(&skt, N, y) < 1e-8);
+
+    const ff_ParamHandle w = AddParam(&skt, 0.0);
+    AddEq(&skt, Fix(w, 3.0));
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(!skt.stats.pattern_reused);
+    CHECK(fabs(Value(&skt, w) - 3.0) < 1e-10);
+    ffSketch_Free(&skt);
+}
+
+// Default equilibration keeps the minimum-norm step of an under-constrained
+// chain: it converges as fast as the unscaled solve, and drags track.
+static void Test_UnderConstrainedScaling(void) {
+    enum { N = 50 };
+    ff_ParamHandle x[N], y[N];
+    uint32_t iterations[2] = { 0, 0 };
+    for (int scaled = 0; scaled < 2; scaled++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 128, 8, 128);
+        if (!scaled) skt.config.equilibrate = FF_EQUIL_NONE;
+        AddWavyChain(&skt, N, x, y);
+
+        CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+        CHECK(ChainError(&skt, N, x, y) < 1e-8);
+        iterations[scaled] = skt.stats.iterations;
+
+        //drag the free end a little each frame
+        ff_ParamHandle end[2] = { x[N - 1], y[N - 1] };
+        const ff_float x0 = Value(&skt, x[N - 1]), y0 = Value(&skt, y[N - 1]);
+        bool tracked = ffSketch_BeginDrag(&skt, end, 2);
+        for (int f = 1; f <= 20; f++) {
+            const ff_float to[2] = { x0 - 0.05 * f, y0 + 0.05 * f };
+            tracked = ffSketch_Drag(&skt, to, 1e-9, 30) && tracked;
+            tracked = fabs(Value(&skt, x[N - 1]) - to[0]) < 1e-8 && tracked;
+        }
+        ffSketch_EndDrag(&skt);
+        CHECK(tracked);
+        CHECK(ChainError(&skt, N, x, y) < 1e-8);
+        ffSketch_Free(&skt);
+    }
+    CHECK(iterations[1] <= iterations[0] + 1);
+}
+
+// (x - cx)^2 + (y - cy)^2 - r^2
+static ff_Expr* OnCircle(ff_ParamHandle x, ff_ParamHandle y, ff_float cx, ff_float cy, ff_float r) {
+    ff_Expr* dx = exprInit_op(OperatorType_SQR, exprInit_op(OperatorType_SUB, exprInit_param(x), exprInit_const(cx)), NULL);
+    ff_Expr* dy = exprInit_op(OperatorType_SQR, exprInit_op(OperatorType_SUB, exprInit_param(y), exprInit_const(cy)), NULL);
+    return exprInit_op(OperatorType_SUB, exprInit_op(OperatorType_ADD, dx, dy), exprInit_const(r * r));
+}
+
+// A duplicated constraint is reported redundant and the solve succeeds; one
+// that contradicts the others is reported conflicting and the solve fails.
+static void Test_DependentConstraints(void) {
+    for (int conflict = 0; conflict < 2; conflict++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 8, 8, 8);
+        skt.config.decompose = false;
+        const ff_ParamHandle a = AddParam(&skt, 0.0);
+        const ff_ParamHandle b = AddParam(&skt, 0.0);
+        AddEq(&skt, Fix(a, 1.0));
+        AddEq(&skt, exprInit_op(OperatorType_SUB, exprInit_op(OperatorType_ADD, exprInit_param(a), exprInit_param(b)), exprInit_const(3.0)));
+        const ff_ConstraintHandle dup = AddEq(&skt, Fix(a, conflict ? 2.0 : 1.0));
+
+        ff_ConstraintHandle out[4];
+        const bool ok = ffSketch_Solve(&skt, 1e-10, 50);
+        const uint16_t redundant   = ffSketch_DependentConstraints(&skt, FF_DEPENDENT_REDUNDANT, NULL, 0);
+        const uint16_t conflicting = ffSketch_DependentConstraints(&skt, FF_DEPENDENT_CONFLICTING, out, 4);
+        if (conflict) {
+            CHECK(!ok);
+            CHECK(skt.stats.result == FF_SOLVE_CONFLICTING);
+            CHECK(redundant == 0 && conflicting == 1);
+            CHECK(conflicting == 1 && ffConstraint_Equals(out[0], dup));
+        } else {
+            CHECK(ok);
+            CHECK(redundant == 1 && conflicting == 0);
+            CHECK(ffSketch_DependentConstraints(&skt, FF_DEPENDENT_REDUNDANT, out, 4) == 1 && ffConstraint_Equals(out[0], dup));
+            CHECK(fabs(Value(&skt, b) - 2.0) < 1e-10);
+        }
+        ffSketch_Free(&skt);
+    }
+}
+
+// A point asked to lie on two circles that do not meet: the residual
+// oscillates without improving, and the solve gives up long before max_steps.
+static void Test_InfeasibleStalls(void) {
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 8, 8, 8);
+    const ff_ParamHandle x = AddParam(&skt, 2.0);
+    const ff_ParamHandle y = AddParam(&skt, 0.5);
+    AddEq(&skt, OnCircle(x, y, 0.0, 0.0, 1.0));
+    AddEq(&skt, OnCircle(x, y, 5.0, 0.0, 1.0));
+
+    CHECK(!ffSketch_Solve(&skt, 1e-10, 200));
+    CHECK(skt.stats.result == FF_SOLVE_STALLED || skt.stats.result == FF_SOLVE_DIVERGED);
+    CHECK(skt.stats.iterations < 50);
+    ffSketch_Free(&skt);
+}
+
+// a = 1 + ta, a*b = 3 + tb
+static void BuildProduct(ff_Sketch* skt, ff_float ta, ff_float tb, ff_ParamHandle* a, ff_ParamHandle* b, ff_ConstraintHandle* drivers) {
+    *a = AddParam(skt, 0.2);
+    *b = AddParam(skt, 0.1);
+    drivers[0] = AddEq(skt, Fix(*a, 1.0 + ta));
+    drivers[1] = AddEq(skt, exprInit_op(OperatorType_SUB, exprInit_op(OperatorType_MUL, exprInit_param(*a), exprInit_param(*b)), exprInit_const(3.0 + tb)));
+}
+
+// Sensitivities (and the prediction built on them) are taken at the solution,
+// not at the iterate whose factorization the solve ended with: they match
+// finite-difference re-solves whatever the decomposition and backend.
+static void Test_Sensitivity(void) {
+    const ff_float h = 1e-6;
+    for (int mode = 0; mode < 4; mode++) {
+        ff_Sketch skt;
+        ff_ParamHandle a, b, p[2];
+        ff_ConstraintHandle drivers[2];
+        ffSketch_Init(&skt, 8, 8, 8);
+        skt.config.closed_form = false; //iterate, so the last factorization is not at the solution
+        skt.config.triangular  = mode == 1;
+        skt.config.decompose   = mode != 2;
+        if (mode == 3) { skt.config.decompose = false; skt.config.linear = FF_LINEAR_DENSE; }
+        BuildProduct(&skt, 0.0, 0.0, &a, &b, drivers);
+        CHECK(ffSketch_Solve(&skt, 1e-12, 50));
+        p[0] = a;
+        p[1] = b;
+        ff_float dxdt[4];
+        CHECK(ffSketch_Sensitivity(&skt, drivers, 2, p, 2, dxdt));
+
+        for (int d = 0; d < 2; d++) {
+            ff_Sketch fd;
+            ff_ParamHandle fa, fb;
+            ff_ConstraintHandle fdrv[2];
+            ffSketch_Init(&fd, 8, 8, 8);
+            BuildProduct(&fd, d == 0 ? h : 0.0, d == 1 ? h : 0.0, &fa, &fb, fdrv);
+            CHECK(ffSketch_Solve(&fd, 1e-12, 50));
+            CHECK(fabs(dxdt[d * 2 + 0] - (Value(&fd, fa) - 1.0) / h) < 1e-4);
+            CHECK(fabs(dxdt[d * 2 + 1] - (Value(&fd, fb) - 3.0) / h) < 1e-4);
+            ffSketch_Free(&fd);
+        }
+        CHECK(fabs(dxdt[1] + 3.0) < 1e-6); //db/da-target = -3/a^2 at a = 1
+
+        //the prediction for a small shift of the first target lands on the re-solve
+        const ff_float delta[2] = { 1e-3, 0.0 };
+        CHECK(ffSketch_Predict(&skt, drivers, delta, 2));
+        CHECK(fabs(Value(&skt, a) - 1.001) < 1e-9);
+        CHECK(fabs(Value(&skt, b) - 3.0 / 1.001) < 1e-5);
+        ffSketch_Free(&skt);
+    }
+}
+
+// Two chains that share no parameter are two components, each solved (and
+// reported) on its own; joining them makes one.
+static void Test_Components(void) {
+    enum { A = 6, B = 9 };
+    ff_ParamHandle ax[A], ay[A], bx[B], by[B];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 64, 8, 64);
+    AddWavyChain(&skt, A, ax, ay);
+    AddWavyChain(&skt, B, bx, by);
+    const ff_ParamHandle loose = AddParam(&skt, 0.0);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ffSketch_ComponentCount(&skt) == 2);
+    const uint16_t ca = ffSketch_ParameterComponent(&skt, ax[A - 1]);
+    const uint16_t cb = ffSketch_ParameterComponent(&skt, bx[B - 1]);
+    CHECK(ca != cb && ca < 2 && cb < 2);
+    CHECK(ffSketch_ParameterComponent(&skt, loose) == FF_INVALID_INDEX);
+    CHECK(ffSketch_ComponentStats(&skt, ca)->cols == 2 * A);
+    CHECK(ffSketch_ComponentStats(&skt, cb)->cols == 2 * B);
+    CHECK(ffSketch_ComponentStats(&skt, 2) == NULL);
+    CHECK(skt.stats.components == 2);
+    CHECK(ChainError(&skt, A, ax, ay) < 1e-8 && ChainError(&skt, B, bx, by) < 1e-8);
+
+    const ff_ConstraintHandle join = AddEq(&skt, Dist(ax[A - 1], ay[A - 1], bx[B - 1], by[B - 1], 2.0));
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ffSketch_ComponentCount(&skt) == 1);
+    CHECK(ffSketch_ConstraintComponent(&skt, join) == 0);
+    CHECK(ChainError(&skt, A, ax, ay) < 1e-8 && ChainError(&skt, B, bx, by) < 1e-8);
+    ffSketch_Free(&skt);
+}
+
+// A component whose constraints can be solved in sequence is split into
+// blocks of one: a is fixed first, then b follows from it.
+static void Test_TriangularBlocks(void) {
+    for (int triangular = 0; triangular < 2; triangular++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 8, 8, 8);
+        skt.config.triangular = triangular != 0;
+        const ff_ParamHandle a = AddParam(&skt, 0.2);
+        const ff_ParamHandle b = AddParam(&skt, 0.1);
+        AddEq(&skt, Fix(a, 2.0));
+        AddEq(&skt, exprInit_op(OperatorType_SUB, exprInit_op(OperatorType_MUL, exprInit_param(a), exprInit_param(b)), exprInit_const(3.0)));
+        CHECK(ffSketch_Solve(&skt, 1e-12, 50));
+        CHECK(skt.stats.components == 1);
+        CHECK(skt.stats.blocks == (triangular ? 2 : 1));
+        CHECK(fabs(Value(&skt, a) - 2.0) < 1e-12);
+        CHECK(fabs(Value(&skt, b) - 1.5) < 1e-10);
+        ffSketch_Free(&skt);
+    }
+}
+
+// A point on two intersecting circles is a 2x2 quadratic system: it is
+// solved in closed form, taking the root nearest the start, and the solve
+// then only confirms it.
+static void Test_ClosedForm(void) {
+    for (int closed = 0; closed < 2; closed++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 8, 8, 8);
+        skt.config.closed_form = closed != 0;
+        const ff_ParamHandle x = AddParam(&skt, 1.2);
+        const ff_ParamHandle y = AddParam(&skt, 0.5);
+        AddEq(&skt, OnCircle(x, y, 0.0, 0.0, 2.0));
+        AddEq(&skt, OnCircle(x, y, 3.0, 0.0, 2.0));
+        CHECK(ffSketch_Solve(&skt, 1e-12, 50));
+        CHECK(fabs(Value(&skt, x) - 1.5) < 1e-10);
+        CHECK(fabs(Value(&skt, y) - sqrt(1.75)) < 1e-10);
+        CHECK(skt.stats.closed_form == (closed ? 1 : 0));
+        if (closed) CHECK(skt.stats.iterations == 1);
+        ffSketch_Free(&skt);
+    }
+}
+
+// Relinking after the parameter and constraint tables grew (and moved): the
+// untouched component is kept and must follow its rows to the new storage.
+// Run under AddressSanitizer to catch reads of the old tables.
+static void Test_RelinkAfterGrowth(void) {
+    enum { A = 4, B = 40 };
+    ff_ParamHandle ax[A], ay[A], bx[B], by[B];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 8, 8, 8);
+    AddChain(&skt, A, ax, ay);
+    AddChain(&skt, 2, bx, by);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ffSketch_ComponentCount(&skt) == 2);
+
+    //grow the second chain well past the initial capacities
+    for (uint32_t i = 2; i < B; i++) {
+        bx[i] = AddParam(&skt, 0.9 * i);
+        by[i] = AddParam(&skt, (i % 2) ? 0.4 : 0.0);
+        AddEq(&skt, Dist(bx[i - 1], by[i - 1], bx[i], by[i], 1.0));
+        if (i % 9 == 0) CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    }
+    CHECK(skt.params.cap >= 2 * (A + B));
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ffSketch_ComponentCount(&skt) == 2);
+    CHECK(ChainError(&skt, A, ax, ay) < 1e-8);
+    CHECK(ChainError(&skt, B, bx, by) < 1e-8);
+
+    //the kept chain still solves from its rebased rows
+    ffSketch_GetParameter(&skt, ay[A - 1])->def.v += 0.3;
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ChainError(&skt, A, ax, ay) < 1e-8);
+    ffSketch_Free(&skt);
+}
+
+// Structural DOF: a pinned chain of n points keeps n-1, a parameter no
+// constraint uses one more. The queries read the pattern only, so they
+// neither relink nor differentiate, and with the link outdated they number
+// components in creation order.
+static void Test_DegreesOfFreedom(void) {
+    enum { A = 5, B = 3 };
+    ff_ParamHandle ax[A], ay[A], bx[B], by[B];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 64, 8, 64);
+    AddChain(&skt, A, ax, ay);
+    AddChain(&skt, B, bx, by);
+    const ff_ParamHandle loose = AddParam(&skt, 0.0);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, FF_INVALID_INDEX) == (A - 1) + (B - 1) + 1);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, 0) == A - 1);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, 1) == B - 1);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, 2) == 0);
+    CHECK(skt.link_outdated);
+
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ffSketch_DegreesOfFreedom(&skt, ffSketch_ParameterComponent(&skt, ax[0])) == A - 1);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, ffSketch_ParameterComponent(&skt, bx[0])) == B - 1);
+
+    //an edit to the first chain: the next relink keeps the second one and
+    //numbers it first, the query before it still goes by creation order
+    const uint32_t differentiated = skt.stats.differentiated;
+    AddEq(&skt, Fix(ay[A - 1], 0.5));
+    CHECK(ffSketch_DegreesOfFreedom(&skt, 0) == A - 2);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, 1) == B - 1);
+    CHECK(skt.link_outdated && skt.stats.differentiated == differentiated);
+    CHECK(ffSketch_ComponentCount(&skt) == 2);
+    CHECK(ffSketch_ParameterComponent(&skt, bx[0]) == 0);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, ffSketch_ParameterComponent(&skt, ax[0])) == A - 2);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, ffSketch_ParameterComponent(&skt, bx[0])) == B - 1);
+
+    ff_ParamHandle free_params[2 * (A + B) + 1];
+    const uint16_t nfree = ffSketch_FreeParameters(&skt, free_params, 2 * (A + B) + 1);
+    CHECK(nfree >= (A - 2) + (B - 1) + 1);
+    bool listed = false;
+    for (uint16_t i = 0; i < nfree; i++) listed |= ffParam_Equals(free_params[i], loose);
+    CHECK(listed);
+    CHECK(ffSketch_OverdeterminingConstraints(&skt, NULL, 0) == 0);
+
+    //pinning the second chain's first point twice over-determines it, DOF stay
+    AddEq(&skt, Fix(bx[0], 0.0));
+    CHECK(ffSketch_OverdeterminingConstraints(&skt, NULL, 0) == 2);
+    CHECK(ffSketch_DegreesOfFreedom(&skt, FF_INVALID_INDEX) == (A - 2) + (B - 1) + 1);
+    ffSketch_Free(&skt);
+}
+
+// Components solved on four workers end exactly where a single thread
+// leaves them: each is solved the same way whichever worker takes it.
+static void Test_ThreadedComponents(void) {
+    enum { K = 12, N = 16 };
+    ff_float first[K][N];
+    for (int threads = 1; threads <= 4; threads += 3) {
+        ff_ParamHandle x[K][N], y[K][N];
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 512, 8, 512);
+        skt.config.threads = threads;
+        for (uint32_t k = 0; k < K; k++) AddWavyChain(&skt, 4 + k, x[k], y[k]);
+        CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+        CHECK(skt.stats.components == K);
+        for (uint32_t k = 0; k < K; k++) {
+            CHECK(ChainError(&skt, 4 + k, x[k], y[k]) < 1e-8);
+            for (uint32_t i = 0; i < 4 + k; i++) {
+                if (threads == 1) first[k][i] = Value(&skt, y[k][i]);
+                else CHECK(Value(&skt, y[k][i]) == first[k][i]);
+            }
+        }
+        ffSketch_Free(&skt);
+    }
+}
+
+// An edit relinks in proportion to its size: adding a constraint only
+// differentiates its own entries, deleting it differentiates nothing, and
+// results follow the edits either way.
+static void Test_IncrementalRelink(void) {
+    enum { N = 40 };
+    for (int decompose = 0; decompose < 2; decompose++) {
+        ff_ParamHandle x[N], y[N];
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 128, 8, 128);
+        skt.config.decompose = decompose != 0;
+        AddChain(&skt, N, x, y);
+        CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+        CHECK(skt.stats.differentiated >= 4 * (N - 1));
+
+        //a brace between two points: four derivatives
+        const ff_ConstraintHandle brace = AddEq(&skt, Dist(x[N / 2], y[N / 2], x[N / 2 + 2], y[N / 2 + 2], 1.5));
+        CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+        CHECK(skt.stats.differentiated == 4);
+        const ff_float dx = Value(&skt, x[N / 2 + 2]) - Value(&skt, x[N / 2]);
+        const ff_float dy = Value(&skt, y[N / 2 + 2]) - Value(&skt, y[N / 2]);
+        CHECK(fabs(sqrt(dx * dx + dy * dy) - 1.5) < 1e-8);
+
+        CHECK(ffSketch_DeleteConstraint(&skt, brace));
+        ffSketch_GetParameter(&skt, y[N - 1])->def.v += 0.5;
+        CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+        CHECK(skt.stats.differentiated == 0);
+        CHECK(skt.stats.rows == N + 1);
+        CHECK(ChainError(&skt, N, x, y) < 1e-8);
+        ffSketch_Free(&skt);
+    }
+}
+
+// Dragging a chain's free end: every frame lands the end on its target with
+// the links intact, a chain the drag does not reach stays put, and ending the
+// drag drops the constraints it added.
+static void Test_Drag(void) {
+    enum { A = 8, B = 5 };
+    ff_ParamHandle ax[A], ay[A], bx[B], by[B];
+    ff_Sketch skt;
+    ffSketch_Init(&skt, 64, 8, 64);
+    AddChain(&skt, A, ax, ay);
+    AddChain(&skt, B, bx, by);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    const uint16_t constraints = skt.constraints.alive_count;
+    ff_float bv[B];
+    for (uint32_t i = 0; i < B; i++) bv[i] = Value(&skt, by[i]);
+
+    const ff_ParamHandle end[2] = { ax[A - 1], ay[A - 1] };
+    ff_float target[2] = { Value(&skt, ax[A - 1]), Value(&skt, ay[A - 1]) };
+    CHECK(ffSketch_BeginDrag(&skt, end, 2));
+    CHECK(!ffSketch_BeginDrag(&skt, end, 2));
+    CHECK(skt.constraints.alive_count == constraints + 2);
+    const ff_Sketch* parts = NULL;
+    for (int frame = 1; frame <= 6; frame++) {
+        target[0] -= 0.1;
+        target[1] += 0.15;
+        CHECK(ffSketch_Drag(&skt, target, 1e-10, 20));
+        CHECK(fabs(Value(&skt, ax[A - 1]) - target[0]) < 1e-8);
+        CHECK(fabs(Value(&skt, ay[A - 1]) - target[1]) < 1e-8);
+        CHECK(ChainError(&skt, A, ax, ay) < 1e-8);
+        //the first frame links the two drag constraints, the others keep that link
+        CHECK(skt.stats.differentiated == 2);
+        if (frame == 1) parts = skt.parts;
+        CHECK(skt.parts == parts);
+    }
+    CHECK(parts != NULL);
+    for (uint32_t i = 0; i < B; i++) CHECK(Value(&skt, by[i]) == bv[i]);
+
+    ffSketch_EndDrag(&skt);
+    CHECK(skt.constraints.alive_count == constraints);
+    CHECK(fabs(Value(&skt, ax[A - 1]) - target[0]) < 1e-8);
+    CHECK(ffSketch_Solve(&skt, 1e-10, 50));
+    CHECK(ChainError(&skt, A, ax, ay) < 1e-8);
+    ffSketch_Free(&skt);
+}
+
+// Timed slices go on where the last one stopped, iteration and monitor
+// state included: one iteration per call ends where a single solve does,
+// down to stopping an infeasible sketch for stalling, a Jacobian reused
+// across calls and rows set aside as dependent.
+static void Test_TimedResume(void) {
+    for (int mode = 0; mode < 3; mode++) {
+        ff_Sketch whole, timed;
+        ff_ParamHandle x[2][12], y[2][12];
+        for (int run = 0; run < 2; run++) {
+            ff_Sketch* skt = run ? &timed : &whole;
+            ffSketch_Init(skt, 64, 8, 64);
+            if (mode == 0) {
+                x[run][0] = AddParam(skt, 2.0);
+                y[run][0] = AddParam(skt, 0.5);
+                AddEq(skt, OnCircle(x[run][0], y[run][0], 0.0, 0.0, 1.0));
+                AddEq(skt, OnCircle(x[run][0], y[run][0], 5.0, 0.0, 1.0));
+            } else {
+                skt->config.jacobian_update = (mode == 1) ? FF_JACOBIAN_CHORD : FF_JACOBIAN_EXACT;
+                skt->config.decompose       = false;
+                AddWavyChain(skt, 12, x[run], y[run]);
+                if (mode == 2) AddEq(skt, Dist(x[run][0], y[run][0], x[run][1], y[run][1], 1.0));
+            }
+        }
+        const bool converged = ffSketch_Solve(&whole, 1e-10, 200);
+        uint32_t calls = 0;
+        bool     done  = false;
+        do {
+            done = ffSketch_SolveTimed(&timed, 1e-10, 200, 0);
+            calls++;
+        } while (timed.stats.result == FF_SOLVE_PAUSED && calls < 300);
+        CHECK(done == converged);
+        CHECK(timed.stats.result == whole.stats.result);
+        CHECK(timed.stats.iterations == whole.stats.iterations);
+        CHECK(calls <= whole.stats.iterations + 1);
+        if (mode == 0) CHECK(timed.stats.result == FF_SOLVE_STALLED || timed.stats.result == FF_SOLVE_DIVERGED);
+        if (mode == 2) CHECK(timed.stats.redundant == 1 && whole.stats.redundant == 1);
+        for (uint32_t i = 0; i < (mode ? 12u : 1u); i++) {
+            CHECK(Value(&timed, x[1][i]) == Value(&whole, x[0][i]));
+            CHECK(Value(&timed, y[1][i]) == Value(&whole, y[0][i]));
+        }
+        ffSketch_Free(&whole);
+        ffSketch_Free(&timed);
+    }
+}
+
+// Cancelling a background solve that set a dependent row aside hands back a
+// link whose packed rows moved meanwhile; the sketch's constraints must
+// follow them before the next solve (run under AddressSanitizer).
+static void Test_CancelAfterDependent(void) {
+    for (int decompose = 0; decompose < 2; decompose++) {
+        ff_Sketch skt;
+        ffSketch_Init(&skt, 8, 8, 8);
+        skt.config.decompose = decompose != 0;
+        const ff_ParamHandle a = AddParam(&skt, 0.0);
+        const ff_ParamHandle b = AddParam(&skt, 0.0);
+        const ff_ParamHandle c = AddParam(&skt, 1.0);
+        ff_Expr* sum[2];
+        for (int i = 0; i < 2; i++) sum[i] = exprInit_op(OperatorType_SUB, exprInit_op(OperatorType_ADD, exprInit_param(a), exprInit_param(b)), exprInit_const(3.0));
+        AddEq(&skt, Fix(a, 1.0));
+        AddEq(&skt, sum[0]);
+        AddEq(&skt, sum[1]);
+        AddEq(&skt, exprInit_op(OperatorType_SUB, exprInit_op(OperatorType_SQR, exprInit_param(c), NULL), exprInit_const(4.0)));
+
+        ff_SolveJob* job = ffSketch_SolveAsync(&skt, 1e-12, 50);
+        CHECK(job != NULL);
+        ffSolveJob_Cancel(job);
+        CHECK(skt.stats.result == FF_SOLVE_CANCELLED);
+        CHECK(ffSketch_Solve(&skt, 1e-12, 50));
+        CHECK(skt.stats.redundant == 1);
+        CHECK(fabs(Value(&skt, a) - 1.0) < 1e-12);
+        CHECK(fabs(Value(&skt, b) - 2.0) < 1e-10);
+        CHECK(fabs(Value(&skt, c) - 2.0) < 1e-10);
+        ffSketch_Free(&skt);
+    }
+}
+
+typedef struct Test {
+    const char* name;
+    void      (*run)(void);
+} Test;
+
+static const Test tests[] = {
+    { "lsqr_minimum_norm", Test_LSQRMinimumNorm },
+    { "normal_form", Test_NormalForm },
+    { "square_lu", Test_SquareLU },
+    { "dense_blocked", Test_DenseBlocked },
+    { "jacobian_reuse", Test_JacobianReuse },
+    { "mixed_precision", Test_MixedPrecision },
+    { "custom_backend", Test_CustomBackend },
+    { "auto_selection", Test_AutoSelection },
+    { "small_fallback", Test_SmallFallback },
+    { "band_reorder", Test_BandReorder },
+    { "pattern_cache", Test_PatternCache },
+    { "under_constrained_scaling", Test_UnderConstrainedScaling },
+    { "dependent_constraints", Test_DependentConstraints },
+    { "infeasible_stalls", Test_InfeasibleStalls },
+    { "sensitivity", Test_Sensitivity },
+    { "components", Test_Components },
+    { "triangular_blocks", Test_TriangularBlocks },
+    { "closed_form", Test_ClosedForm },
+    { "relink_after_growth", Test_RelinkAfterGrowth },
+    { "degrees_of_freedom", Test_DegreesOfFreedom },
+    { "threaded_components", Test_ThreadedComponents },
+    { "incremental_relink", Test_IncrementalRelink },
+    { "drag", Test_Drag },
+    { "timed_resume", Test_TimedResume },
+    { "cancel_after_dependent", Test_CancelAfterDependent },
+};
+
+int main(void) {
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        const int before = failures;
+        tests[i].run();
+        printf("%s %s\n", failures == before ? "ok  " : "FAIL", tests[i].name);
+    }
+    printf("%d failure(s)\n", failures);
+    return failures != 0;
+}